@@ -3,44 +3,360 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "plato_thread.h"
 
 #define PL_ARENA_MEM_ALIGN(p, a) ((p + (a - 1)) & ~(a - 1))
 
+#define PL_ARENA_COMMIT_SIZE       (64 * 1024)
+#define PL_ARENA_HUGE_PAGE_SIZE    (2 * 1024 * 1024)
+
+// Flags for pl_arena_init_reserve
+#define PL_ARENA_HUGE_PAGES        1
+#define PL_ARENA_HUGETLB           2
+#define _PL_ARENA_RESERVED         0x100
+
+#define PL_SLAB_CLASS_COUNT        16
+#define PL_SLAB_MAX_SIZE           2048
+#define PL_SLAB_CACHE_SIZE         32
+#define PL_SLAB_STATS_SLACK        (64 * 1024)
+
+// Typed helpers; PL_ARENA_NEW zero-fills, PL_ARENA_NEW_ARRAY does not
+#define PL_ARENA_NEW(arena, T) ((T*)pl_arena_aligned_alloc((arena), sizeof(T), _Alignof(T)))
+#define PL_ARENA_NEW_ARRAY(arena, T, count) ((T*)pl_arena_alloc_array((arena), (count), sizeof(T), _Alignof(T)))
+
+typedef struct pl_arena_block_s pl_arena_block_t;
+
+// 'data', 'capacity' and 'offset' describe the block currently bumped into.
+// Fixed arenas own a single block and never grow; chained arenas link a new
+// block (at least 'block_size' bytes, doubling each time) when one fills up.
+// Reserved arenas own one address range of 'capacity' bytes of which only
+// the first 'committed' are backed by memory.
 typedef struct pl_arena_s {
     void *data;
     size_t capacity;
     size_t offset;
+    pl_arena_block_t *block;
+    pl_arena_block_t *spare;
+    size_t block_size;
+    size_t committed;
+    size_t high_water;
+    int flags;
 } pl_arena_t;
 
+// Position returned by pl_arena_mark; rewinding to it releases everything
+// allocated since
+typedef struct pl_arena_mark_s {
+    pl_arena_block_t *block;
+    size_t offset;
+} pl_arena_mark_t;
+
+typedef struct _pl_arena_group_entry_s _pl_arena_group_entry_t;
+
+// One chained arena per thread, handed out by pl_arena_group_get. Arenas of
+// exited threads are adopted by the next thread that asks for one.
+typedef struct pl_arena_group_s {
+    pl_tss_t key;
+    pl_mtx_t lock;
+    _pl_arena_group_entry_t *entries;
+    size_t block_size;
+} pl_arena_group_t;
+
+// Fixed-capacity arena that any number of threads can allocate from at once
+typedef struct pl_arena_shared_s {
+    void *data;
+    size_t capacity;
+    atomic_size_t offset;
+} pl_arena_shared_t;
+
+// Fixed-size slots carved from a chained arena and recycled through an
+// intrusive free list. Not thread-safe.
+typedef struct pl_pool_s {
+    pl_arena_t *arena;
+    void *free_list;
+    size_t slot_size;
+    size_t alignment;
+    size_t live;
+    size_t peak;
+    size_t carved;
+} pl_pool_t;
+
+typedef struct pl_alloc_stats_s {
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t reserved_bytes;
+    double fragmentation;
+} pl_alloc_stats_t;
+
+typedef struct _pl_slab_cache_s _pl_slab_cache_t;
+
+// Size-class allocator over one pool per class (16 to PL_SLAB_MAX_SIZE
+// bytes, larger requests go to malloc). Each thread keeps a small cache per
+// class, so the class locks are only taken to refill or flush a batch.
+typedef struct pl_slab_s {
+    pl_pool_t *classes[PL_SLAB_CLASS_COUNT];
+    pl_mtx_t class_locks[PL_SLAB_CLASS_COUNT];
+    pl_tss_t key;
+    pl_mtx_t lock;
+    _pl_slab_cache_t *caches;
+    atomic_llong live_bytes;
+    atomic_llong peak_bytes;
+} pl_slab_t;
+
 pl_arena_t *pl_arena_init(size_t capacity);
+pl_arena_t *pl_arena_init_chained(size_t block_size);
+pl_arena_t *pl_arena_init_reserve(size_t max_bytes, int flags);
 void *pl_arena_alloc(pl_arena_t *arena, size_t size);
 void *pl_arena_aligned_alloc(pl_arena_t *arena, size_t size, size_t alignment);
+void *pl_arena_alloc_uninit(pl_arena_t *arena, size_t size);
+void *pl_arena_aligned_alloc_uninit(pl_arena_t *arena, size_t size, size_t alignment);
+void *pl_arena_alloc_array(pl_arena_t *arena, size_t count, size_t size, size_t alignment);
+pl_arena_mark_t pl_arena_mark(pl_arena_t *arena);
+void pl_arena_rewind(pl_arena_t *arena, pl_arena_mark_t mark);
 void pl_arena_free(pl_arena_t *arena);
 void pl_arena_reset(pl_arena_t *arena);
+pl_arena_group_t *pl_arena_group_init(size_t block_size);
+pl_arena_t *pl_arena_group_get(pl_arena_group_t *group);
+void pl_arena_group_reset(pl_arena_group_t *group);
+void pl_arena_group_free(pl_arena_group_t *group);
+pl_arena_shared_t *pl_arena_shared_init(size_t capacity);
+void *pl_arena_shared_alloc(pl_arena_shared_t *shared, size_t size, size_t alignment);
+void *pl_arena_shared_alloc_uninit(pl_arena_shared_t *shared, size_t size, size_t alignment);
+void pl_arena_shared_reset(pl_arena_shared_t *shared);
+void pl_arena_shared_free(pl_arena_shared_t *shared);
+pl_pool_t *pl_pool_init(size_t object_size, size_t alignment, size_t objects_per_block);
+void *pl_pool_alloc(pl_pool_t *pool);
+void pl_pool_free(pl_pool_t *pool, void *ptr);
+void pl_pool_stats(pl_pool_t *pool, pl_alloc_stats_t *stats);
+void pl_pool_destroy(pl_pool_t *pool);
+pl_slab_t *pl_slab_init(void);
+void *pl_slab_alloc(pl_slab_t *slab, size_t size);
+void pl_slab_free(pl_slab_t *slab, void *ptr, size_t size);
+void pl_slab_stats(pl_slab_t *slab, pl_alloc_stats_t *stats);
+void pl_slab_destroy(pl_slab_t *slab);
 
 #if defined(PLATO_IMPLEMENTATION) || defined(PLATO_ARENA_IMPLEMENTATION)
 
+#if !defined(_WIN32)
+    #include <sys/mman.h>
+#endif
+
+// Header placed in front of the data of every chained block
+typedef struct pl_arena_block_s {
+    pl_arena_block_t *prev;
+    size_t capacity;
+} pl_arena_block_t;
+
 pl_arena_t *pl_arena_init(size_t capacity) {
     pl_arena_t *arena = malloc(sizeof(pl_arena_t));
     if(!arena) return NULL;
 
     arena->data = malloc(capacity);
-    if(!arena->data) return NULL;
+    if(!arena->data) {
+        free(arena);
+        return NULL;
+    }
 
     arena->capacity = capacity;
     arena->offset = 0;
+    arena->block = NULL;
+    arena->spare = NULL;
+    arena->block_size = 0;
+    arena->committed = 0;
+    arena->high_water = 0;
+    arena->flags = 0;
+    return arena;
+}
+
+static inline void *_pl_arena_block_data_internal(pl_arena_block_t *block) {
+    return (void*)((char*)block + sizeof(pl_arena_block_t));
+}
+
+static void _pl_arena_use_block_internal(pl_arena_t *arena, pl_arena_block_t *block) {
+    arena->block = block;
+    arena->data = _pl_arena_block_data_internal(block);
+    arena->capacity = block->capacity;
+    arena->offset = 0;
+}
+
+// Keeps the largest released block around so the next growth can reuse it
+static void _pl_arena_release_block_internal(pl_arena_t *arena, pl_arena_block_t *block) {
+    if(arena->spare && arena->spare->capacity >= block->capacity) {
+        free(block);
+        return;
+    }
+    free(arena->spare);
+    arena->spare = block;
+}
+
+pl_arena_t *pl_arena_init_chained(size_t block_size) {
+    if(block_size == 0) return NULL;
+
+    pl_arena_t *arena = malloc(sizeof(pl_arena_t));
+    if(!arena) return NULL;
+
+    pl_arena_block_t *block = malloc(sizeof(pl_arena_block_t) + block_size);
+    if(!block) {
+        free(arena);
+        return NULL;
+    }
+    block->prev = NULL;
+    block->capacity = block_size;
+
+    arena->spare = NULL;
+    arena->block_size = block_size;
+    arena->committed = 0;
+    arena->high_water = 0;
+    arena->flags = 0;
+    _pl_arena_use_block_internal(arena, block);
+    return arena;
+}
+
+static inline size_t _pl_arena_commit_granularity_internal(pl_arena_t *arena) {
+    return (arena->flags & (PL_ARENA_HUGE_PAGES | PL_ARENA_HUGETLB)) ? PL_ARENA_HUGE_PAGE_SIZE : PL_ARENA_COMMIT_SIZE;
+}
+
+// Reserves address space only; pages are committed as the offset grows, so
+// pointers never move and resident memory follows actual use. The range is
+// rounded up to the commit granularity.
+pl_arena_t *pl_arena_init_reserve(size_t max_bytes, int flags) {
+    if(max_bytes == 0) return NULL;
+
+    pl_arena_t *arena = malloc(sizeof(pl_arena_t));
+    if(!arena) return NULL;
+
+    arena->offset = 0;
+    arena->block = NULL;
+    arena->spare = NULL;
+    arena->block_size = 0;
+    arena->committed = 0;
+    arena->high_water = 0;
+    arena->flags = (flags & (PL_ARENA_HUGE_PAGES | PL_ARENA_HUGETLB)) | _PL_ARENA_RESERVED;
+
+    size_t granularity = _pl_arena_commit_granularity_internal(arena);
+    if(max_bytes > SIZE_MAX - granularity) {
+        free(arena);
+        return NULL;
+    }
+    arena->capacity = PL_ARENA_MEM_ALIGN(max_bytes, granularity);
+
+#if defined(_WIN32)
+    arena->data = VirtualAlloc(NULL, arena->capacity, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    arena->data = MAP_FAILED;
+#if defined(MAP_HUGETLB)
+    // Explicit huge pages are reserved up front (no MAP_NORESERVE, which would
+    // turn a shortage into SIGBUS on first touch) and fall back to THP
+    if(flags & PL_ARENA_HUGETLB) {
+        arena->data = mmap(NULL, arena->capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if(arena->data == MAP_FAILED) {
+        arena->flags &= ~PL_ARENA_HUGETLB;
+        arena->data = mmap(NULL, arena->capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+#if defined(MADV_HUGEPAGE)
+        if(arena->data != MAP_FAILED && (flags & (PL_ARENA_HUGE_PAGES | PL_ARENA_HUGETLB))) {
+            madvise(arena->data, arena->capacity, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    if(arena->data == MAP_FAILED) arena->data = NULL;
+#endif
+
+    if(!arena->data) {
+        free(arena);
+        return NULL;
+    }
     return arena;
 }
 
+// Commits whole granules so that the first 'end' bytes are usable
+static int _pl_arena_commit_internal(pl_arena_t *arena, size_t end) {
+    size_t target = PL_ARENA_MEM_ALIGN(end, _pl_arena_commit_granularity_internal(arena));
+    if(target > arena->capacity) target = arena->capacity;
+    if(target <= arena->committed) return 0;
+
+    char *start = (char*)arena->data + arena->committed;
+    size_t size = target - arena->committed;
+#if defined(_WIN32)
+    if(!VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE)) return 1;
+#else
+    if(mprotect(start, size, PROT_READ | PROT_WRITE) != 0) return 1;
+#endif
+    arena->committed = target;
+    return 0;
+}
+
+// Returns the pages past 'keep' bytes to the OS
+static void _pl_arena_decommit_internal(pl_arena_t *arena, size_t keep) {
+    keep = PL_ARENA_MEM_ALIGN(keep, _pl_arena_commit_granularity_internal(arena));
+    if(keep >= arena->committed) return;
+
+    char *start = (char*)arena->data + keep;
+    size_t size = arena->committed - keep;
+#if defined(_WIN32)
+    VirtualFree(start, size, MEM_DECOMMIT);
+#else
+    madvise(start, size, MADV_DONTNEED);
+    mprotect(start, size, PROT_NONE);
+#endif
+    arena->committed = keep;
+}
+
+static int _pl_arena_grow_internal(pl_arena_t *arena, size_t size, size_t alignment) {
+    if(!arena->block) return 1;
+
+    size_t needed = size + alignment - 1;
+    if(needed < size) return 1;
+
+    pl_arena_block_t *block = NULL;
+    if(arena->spare && arena->spare->capacity >= needed) {
+        block = arena->spare;
+        arena->spare = NULL;
+    }
+    else {
+        size_t capacity = arena->block_size * 2;
+        if(capacity < arena->block_size) capacity = arena->block_size;
+        if(capacity < needed) capacity = needed;
+        if(capacity > SIZE_MAX - sizeof(pl_arena_block_t)) return 1;
+
+        block = malloc(sizeof(pl_arena_block_t) + capacity);
+        if(!block) return 1;
+        block->capacity = capacity;
+        arena->block_size = capacity;
+    }
+
+    block->prev = arena->block;
+    _pl_arena_use_block_internal(arena, block);
+    return 0;
+}
+
+// Bumps the offset so that the returned address (not just the offset) is
+// aligned; grows chained arenas when the current block is full
+static void *_pl_arena_bump_internal(pl_arena_t *arena, size_t size, size_t alignment) {
+    for(;;) {
+        uintptr_t base = (uintptr_t)arena->data;
+        uintptr_t addr = PL_ARENA_MEM_ALIGN(base + arena->offset, (uintptr_t)alignment);
+        size_t aligned_offset = (size_t)(addr - base);
+        if(aligned_offset <= arena->capacity && size <= arena->capacity - aligned_offset) {
+            size_t end = aligned_offset + size;
+            if((arena->flags & _PL_ARENA_RESERVED) && end > arena->committed) {
+                if(_pl_arena_commit_internal(arena, end) != 0) return NULL;
+            }
+            if(end > arena->high_water) arena->high_water = end;
+            arena->offset = end;
+            return (void*)addr;
+        }
+        if(_pl_arena_grow_internal(arena, size, alignment) != 0) return NULL;
+    }
+}
+
 void *pl_arena_alloc(pl_arena_t *arena, size_t size) {
     if(!arena || !arena->data) return NULL;
 
-    size_t aligned_offset = PL_ARENA_MEM_ALIGN(arena->offset, sizeof(void*));
-    if(aligned_offset + size > arena->capacity) return NULL;
-
-    void *ptr = (void*)((char*)arena->data + aligned_offset);
-    arena->offset = aligned_offset + size;
-    memset(ptr, 0, size);
+    void *ptr = _pl_arena_bump_internal(arena, size, sizeof(void*));
+    if(ptr) memset(ptr, 0, size);
 
     return ptr;
 }
@@ -49,25 +365,581 @@ void *pl_arena_aligned_alloc(pl_arena_t *arena, size_t size, size_t alignment) {
     if(!arena || !arena->data || alignment <= 0) return NULL;
     if((alignment & (alignment - 1)) != 0) return NULL;
 
-    size_t aligned_offset = PL_ARENA_MEM_ALIGN(arena->offset, alignment);
-    if(aligned_offset + size > arena->capacity) return NULL;
-
-    void *ptr = (void*)((char*)arena->data + aligned_offset);
-    arena->offset = aligned_offset + size;
-    memset(ptr, 0, size);
+    void *ptr = _pl_arena_bump_internal(arena, size, alignment);
+    if(ptr) memset(ptr, 0, size);
 
     return ptr;
 }
 
+// Same as pl_arena_alloc and pl_arena_aligned_alloc without the zero-fill,
+// for scratch buffers that are overwritten right away
+void *pl_arena_alloc_uninit(pl_arena_t *arena, size_t size) {
+    if(!arena || !arena->data) return NULL;
+    return _pl_arena_bump_internal(arena, size, sizeof(void*));
+}
+
+void *pl_arena_aligned_alloc_uninit(pl_arena_t *arena, size_t size, size_t alignment) {
+    if(!arena || !arena->data || alignment <= 0) return NULL;
+    if((alignment & (alignment - 1)) != 0) return NULL;
+    return _pl_arena_bump_internal(arena, size, alignment);
+}
+
+// Uninitialized array of 'count' elements of 'size' bytes; NULL on overflow
+void *pl_arena_alloc_array(pl_arena_t *arena, size_t count, size_t size, size_t alignment) {
+    if(size != 0 && count > SIZE_MAX / size) return NULL;
+    return pl_arena_aligned_alloc_uninit(arena, count * size, alignment);
+}
+
+pl_arena_mark_t pl_arena_mark(pl_arena_t *arena) {
+    pl_arena_mark_t mark = {NULL, 0};
+    if(arena) {
+        mark.block = arena->block;
+        mark.offset = arena->offset;
+    }
+    return mark;
+}
+
+// Marks must be rewound innermost first; a mark taken before a reset is invalid
+void pl_arena_rewind(pl_arena_t *arena, pl_arena_mark_t mark) {
+    if(!arena) return;
+
+    while(arena->block && arena->block != mark.block) {
+        pl_arena_block_t *prev = arena->block->prev;
+        if(!prev) return;
+        _pl_arena_release_block_internal(arena, arena->block);
+        _pl_arena_use_block_internal(arena, prev);
+    }
+
+    if(arena->block == mark.block && mark.offset <= arena->capacity) arena->offset = mark.offset;
+}
+
 void pl_arena_free(pl_arena_t *arena) {
-    if(arena && arena->data) {
-        free(arena->data);
-        free(arena);
+    if(!arena) return;
+
+    if(arena->block) {
+        pl_arena_block_t *block = arena->block;
+        while(block) {
+            pl_arena_block_t *prev = block->prev;
+            free(block);
+            block = prev;
+        }
+        free(arena->spare);
+    }
+    else if(arena->flags & _PL_ARENA_RESERVED) {
+#if defined(_WIN32)
+        VirtualFree(arena->data, 0, MEM_RELEASE);
+#else
+        munmap(arena->data, arena->capacity);
+#endif
     }
+    else free(arena->data);
+
+    free(arena);
 }
 
+// Chained arenas keep only their largest block, so once it has grown to fit
+// a whole frame, later frames allocate without touching malloc. Reserved
+// arenas keep the pages the last frame used and decommit the rest.
 void pl_arena_reset(pl_arena_t *arena) {
-    if(arena) arena->offset = 0;
+    if(!arena) return;
+
+    if(arena->flags & _PL_ARENA_RESERVED) _pl_arena_decommit_internal(arena, arena->high_water);
+    arena->high_water = 0;
+
+    if(arena->block) {
+        pl_arena_block_t *largest = arena->spare;
+        pl_arena_block_t *block = arena->block;
+        while(block) {
+            pl_arena_block_t *prev = block->prev;
+            if(!largest || block->capacity > largest->capacity) {
+                free(largest);
+                largest = block;
+            }
+            else free(block);
+            block = prev;
+        }
+
+        largest->prev = NULL;
+        arena->spare = NULL;
+        _pl_arena_use_block_internal(arena, largest);
+    }
+
+    arena->offset = 0;
+}
+
+typedef struct _pl_arena_group_entry_s {
+    pl_arena_t *arena;
+    pl_arena_group_t *group;
+    _pl_arena_group_entry_t *next;
+    int in_use;
+} _pl_arena_group_entry_t;
+
+// Runs at thread exit and hands the arena back to the group
+static void _pl_arena_group_release_internal(void *val) {
+    _pl_arena_group_entry_t *entry = (_pl_arena_group_entry_t*)val;
+    pl_mtx_lock(&entry->group->lock);
+    entry->in_use = 0;
+    pl_mtx_unlock(&entry->group->lock);
+}
+
+pl_arena_group_t *pl_arena_group_init(size_t block_size) {
+    if(block_size == 0) return NULL;
+
+    pl_arena_group_t *group = malloc(sizeof(pl_arena_group_t));
+    if(!group) return NULL;
+
+    if(pl_mtx_init(&group->lock, PL_MTX_PLAIN) != PL_THREAD_SUCCESS) {
+        free(group);
+        return NULL;
+    }
+    if(pl_tss_create(&group->key, _pl_arena_group_release_internal) != PL_THREAD_SUCCESS) {
+        pl_mtx_destroy(&group->lock);
+        free(group);
+        return NULL;
+    }
+
+    group->entries = NULL;
+    group->block_size = block_size;
+    return group;
+}
+
+// Returns the calling thread's arena, creating it on first use. Only that
+// thread may allocate from it; NULL when out of memory.
+pl_arena_t *pl_arena_group_get(pl_arena_group_t *group) {
+    if(!group) return NULL;
+
+    _pl_arena_group_entry_t *entry = (_pl_arena_group_entry_t*)pl_tss_get(group->key);
+    if(entry) return entry->arena;
+
+    pl_mtx_lock(&group->lock);
+    for(entry = group->entries; entry; entry = entry->next) {
+        if(!entry->in_use) break;
+    }
+    if(!entry) {
+        entry = malloc(sizeof(_pl_arena_group_entry_t));
+        pl_arena_t *arena = pl_arena_init_chained(group->block_size);
+        if(!entry || !arena) {
+            pl_mtx_unlock(&group->lock);
+            free(entry);
+            pl_arena_free(arena);
+            return NULL;
+        }
+        entry->arena = arena;
+        entry->group = group;
+        entry->next = group->entries;
+        group->entries = entry;
+    }
+    entry->in_use = 1;
+    pl_mtx_unlock(&group->lock);
+
+    if(pl_tss_set(group->key, entry) != PL_THREAD_SUCCESS) {
+        pl_mtx_lock(&group->lock);
+        entry->in_use = 0;
+        pl_mtx_unlock(&group->lock);
+        return NULL;
+    }
+    return entry->arena;
+}
+
+// Resets every thread's arena; call at a frame boundary when no thread is
+// allocating from the group
+void pl_arena_group_reset(pl_arena_group_t *group) {
+    if(!group) return;
+
+    pl_mtx_lock(&group->lock);
+    for(_pl_arena_group_entry_t *entry = group->entries; entry; entry = entry->next) {
+        pl_arena_reset(entry->arena);
+    }
+    pl_mtx_unlock(&group->lock);
+}
+
+// Threads must not use the group's arenas after this
+void pl_arena_group_free(pl_arena_group_t *group) {
+    if(!group) return;
+
+    pl_tss_delete(group->key);
+    _pl_arena_group_entry_t *entry = group->entries;
+    while(entry) {
+        _pl_arena_group_entry_t *next = entry->next;
+        pl_arena_free(entry->arena);
+        free(entry);
+        entry = next;
+    }
+    pl_mtx_destroy(&group->lock);
+    free(group);
+}
+
+pl_arena_shared_t *pl_arena_shared_init(size_t capacity) {
+    pl_arena_shared_t *shared = malloc(sizeof(pl_arena_shared_t));
+    if(!shared) return NULL;
+
+    shared->data = malloc(capacity);
+    if(!shared->data) {
+        free(shared);
+        return NULL;
+    }
+
+    shared->capacity = capacity;
+    atomic_init(&shared->offset, 0);
+    return shared;
+}
+
+// Lock-free bump: threads race on 'offset' with a compare-exchange, so each
+// allocation costs one atomic operation when uncontended
+void *pl_arena_shared_alloc_uninit(pl_arena_shared_t *shared, size_t size, size_t alignment) {
+    if(!shared || !shared->data || alignment <= 0) return NULL;
+    if((alignment & (alignment - 1)) != 0) return NULL;
+
+    uintptr_t base = (uintptr_t)shared->data;
+    size_t offset = atomic_load_explicit(&shared->offset, memory_order_relaxed);
+    for(;;) {
+        uintptr_t addr = PL_ARENA_MEM_ALIGN(base + offset, (uintptr_t)alignment);
+        size_t aligned_offset = (size_t)(addr - base);
+        if(aligned_offset > shared->capacity || size > shared->capacity - aligned_offset) return NULL;
+
+        if(atomic_compare_exchange_weak_explicit(
+            &shared->offset, &offset, aligned_offset + size,
+            memory_order_relaxed, memory_order_relaxed)) {
+            return (void*)addr;
+        }
+    }
+}
+
+void *pl_arena_shared_alloc(pl_arena_shared_t *shared, size_t size, size_t alignment) {
+    void *ptr = pl_arena_shared_alloc_uninit(shared, size, alignment);
+    if(ptr) memset(ptr, 0, size);
+    return ptr;
+}
+
+// Not safe while other threads are allocating
+void pl_arena_shared_reset(pl_arena_shared_t *shared) {
+    if(shared) atomic_store_explicit(&shared->offset, 0, memory_order_relaxed);
+}
+
+void pl_arena_shared_free(pl_arena_shared_t *shared) {
+    if(!shared) return;
+    free(shared->data);
+    free(shared);
+}
+
+// Slots are at least pointer sized so a free slot can hold the list link
+pl_pool_t *pl_pool_init(size_t object_size, size_t alignment, size_t objects_per_block) {
+    if(alignment < sizeof(void*)) alignment = sizeof(void*);
+    if((alignment & (alignment - 1)) != 0) return NULL;
+    if(object_size < sizeof(void*)) object_size = sizeof(void*);
+    if(objects_per_block == 0) objects_per_block = 64;
+
+    pl_pool_t *pool = malloc(sizeof(pl_pool_t));
+    if(!pool) return NULL;
+
+    pool->slot_size = PL_ARENA_MEM_ALIGN(object_size, alignment);
+    pool->alignment = alignment;
+    pool->arena = pl_arena_init_chained(pool->slot_size * objects_per_block + alignment);
+    if(!pool->arena) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->free_list = NULL;
+    pool->live = 0;
+    pool->peak = 0;
+    pool->carved = 0;
+    return pool;
+}
+
+// O(1): pops the free list, or carves a new slot. The slot is not zeroed.
+void *pl_pool_alloc(pl_pool_t *pool) {
+    if(!pool) return NULL;
+
+    void *ptr = pool->free_list;
+    if(ptr) pool->free_list = *(void**)ptr;
+    else {
+        ptr = pl_arena_aligned_alloc_uninit(pool->arena, pool->slot_size, pool->alignment);
+        if(!ptr) return NULL;
+        pool->carved++;
+    }
+
+    if(++pool->live > pool->peak) pool->peak = pool->live;
+    return ptr;
+}
+
+void pl_pool_free(pl_pool_t *pool, void *ptr) {
+    if(!pool || !ptr) return;
+
+    *(void**)ptr = pool->free_list;
+    pool->free_list = ptr;
+    pool->live--;
+}
+
+static void _pl_alloc_stats_set_internal(pl_alloc_stats_t *stats, size_t live, size_t peak, size_t reserved) {
+    stats->live_bytes = live;
+    stats->peak_bytes = peak;
+    stats->reserved_bytes = reserved;
+    stats->fragmentation = reserved ? 1.0 - (double)live / (double)reserved : 0.0;
+}
+
+void pl_pool_stats(pl_pool_t *pool, pl_alloc_stats_t *stats) {
+    if(!pool || !stats) return;
+    _pl_alloc_stats_set_internal(stats,
+        pool->live * pool->slot_size,
+        pool->peak * pool->slot_size,
+        pool->carved * pool->slot_size);
+}
+
+void pl_pool_destroy(pl_pool_t *pool) {
+    if(!pool) return;
+    pl_arena_free(pool->arena);
+    free(pool);
+}
+
+typedef struct _pl_slab_cache_s {
+    pl_slab_t *slab;
+    _pl_slab_cache_t *next;
+    void *lists[PL_SLAB_CLASS_COUNT];
+    int counts[PL_SLAB_CLASS_COUNT];
+    atomic_llong stats_delta;
+    int in_use;
+} _pl_slab_cache_t;
+
+static const size_t _pl_slab_class_sizes[PL_SLAB_CLASS_COUNT] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+static inline int _pl_slab_class_internal(size_t size) {
+    if(size <= 128) return size ? (int)((size - 1) >> 4) : 0;
+    int c = 8;
+    while(_pl_slab_class_sizes[c] < size) c++;
+    return c;
+}
+
+// Folds a thread's byte count into the shared totals. Peak is only sampled
+// here, so it is accurate to PL_SLAB_STATS_SLACK bytes per thread.
+static void _pl_slab_publish_internal(pl_slab_t *slab, long long delta) {
+    long long live = atomic_fetch_add_explicit(&slab->live_bytes, delta, memory_order_relaxed) + delta;
+    long long peak = atomic_load_explicit(&slab->peak_bytes, memory_order_relaxed);
+    while(live > peak && !atomic_compare_exchange_weak_explicit(
+        &slab->peak_bytes, &peak, live, memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+static inline void _pl_slab_account_internal(pl_slab_t *slab, _pl_slab_cache_t *cache, long long bytes) {
+    if(!cache) {
+        _pl_slab_publish_internal(slab, bytes);
+        return;
+    }
+    // Only the owning thread writes its delta, so a plain load and store will do
+    long long delta = atomic_load_explicit(&cache->stats_delta, memory_order_relaxed) + bytes;
+    if(delta > PL_SLAB_STATS_SLACK || delta < -PL_SLAB_STATS_SLACK) {
+        _pl_slab_publish_internal(slab, delta);
+        delta = 0;
+    }
+    atomic_store_explicit(&cache->stats_delta, delta, memory_order_relaxed);
+}
+
+// Returns 'count' cached objects of class 'c' to the shared pool
+static void _pl_slab_flush_internal(pl_slab_t *slab, _pl_slab_cache_t *cache, int c, int count) {
+    pl_mtx_lock(&slab->class_locks[c]);
+    for(int i = 0; i < count && cache->lists[c]; i++) {
+        void *ptr = cache->lists[c];
+        cache->lists[c] = *(void**)ptr;
+        cache->counts[c]--;
+        pl_pool_free(slab->classes[c], ptr);
+    }
+    pl_mtx_unlock(&slab->class_locks[c]);
+}
+
+// Runs at thread exit: empties the cache and hands it back to the slab
+static void _pl_slab_release_cache_internal(void *val) {
+    _pl_slab_cache_t *cache = (_pl_slab_cache_t*)val;
+    pl_slab_t *slab = cache->slab;
+
+    for(int c = 0; c < PL_SLAB_CLASS_COUNT; c++) {
+        if(cache->counts[c]) _pl_slab_flush_internal(slab, cache, c, cache->counts[c]);
+    }
+    _pl_slab_publish_internal(slab, atomic_load_explicit(&cache->stats_delta, memory_order_relaxed));
+    atomic_store_explicit(&cache->stats_delta, 0, memory_order_relaxed);
+
+    pl_mtx_lock(&slab->lock);
+    cache->in_use = 0;
+    pl_mtx_unlock(&slab->lock);
+}
+
+static _pl_slab_cache_t *_pl_slab_cache_internal(pl_slab_t *slab) {
+    _pl_slab_cache_t *cache = (_pl_slab_cache_t*)pl_tss_get(slab->key);
+    if(cache) return cache;
+
+    pl_mtx_lock(&slab->lock);
+    for(cache = slab->caches; cache; cache = cache->next) {
+        if(!cache->in_use) break;
+    }
+    if(!cache) {
+        cache = calloc(1, sizeof(_pl_slab_cache_t));
+        if(!cache) {
+            pl_mtx_unlock(&slab->lock);
+            return NULL;
+        }
+        atomic_init(&cache->stats_delta, 0);
+        cache->slab = slab;
+        cache->next = slab->caches;
+        slab->caches = cache;
+    }
+    cache->in_use = 1;
+    pl_mtx_unlock(&slab->lock);
+
+    if(pl_tss_set(slab->key, cache) != PL_THREAD_SUCCESS) {
+        pl_mtx_lock(&slab->lock);
+        cache->in_use = 0;
+        pl_mtx_unlock(&slab->lock);
+        return NULL;
+    }
+    return cache;
+}
+
+pl_slab_t *pl_slab_init(void) {
+    pl_slab_t *slab = calloc(1, sizeof(pl_slab_t));
+    if(!slab) return NULL;
+
+    int c = 0;
+    for(; c < PL_SLAB_CLASS_COUNT; c++) {
+        size_t size = _pl_slab_class_sizes[c];
+        slab->classes[c] = pl_pool_init(size, 16, (64 * 1024) / size);
+        if(!slab->classes[c]) break;
+        if(pl_mtx_init(&slab->class_locks[c], PL_MTX_PLAIN) != PL_THREAD_SUCCESS) {
+            pl_pool_destroy(slab->classes[c]);
+            break;
+        }
+    }
+    int ok = (c == PL_SLAB_CLASS_COUNT) && pl_mtx_init(&slab->lock, PL_MTX_PLAIN) == PL_THREAD_SUCCESS;
+    if(ok && pl_tss_create(&slab->key, _pl_slab_release_cache_internal) != PL_THREAD_SUCCESS) {
+        pl_mtx_destroy(&slab->lock);
+        ok = 0;
+    }
+    if(!ok) {
+        while(c-- > 0) {
+            pl_mtx_destroy(&slab->class_locks[c]);
+            pl_pool_destroy(slab->classes[c]);
+        }
+        free(slab);
+        return NULL;
+    }
+
+    slab->caches = NULL;
+    atomic_init(&slab->live_bytes, 0);
+    atomic_init(&slab->peak_bytes, 0);
+    return slab;
+}
+
+// Thread-safe; memory is not zeroed. Free with the same 'size'.
+void *pl_slab_alloc(pl_slab_t *slab, size_t size) {
+    if(!slab) return NULL;
+
+    if(size > PL_SLAB_MAX_SIZE) {
+        void *ptr = malloc(size);
+        if(ptr) _pl_slab_account_internal(slab, _pl_slab_cache_internal(slab), (long long)size);
+        return ptr;
+    }
+
+    int c = _pl_slab_class_internal(size);
+    _pl_slab_cache_t *cache = _pl_slab_cache_internal(slab);
+    void *ptr = NULL;
+
+    if(!cache) {
+        pl_mtx_lock(&slab->class_locks[c]);
+        ptr = pl_pool_alloc(slab->classes[c]);
+        pl_mtx_unlock(&slab->class_locks[c]);
+    }
+    else {
+        if(!cache->lists[c]) {
+            // Refill half a cache at a time so alloc/free ping-pong stays local
+            pl_mtx_lock(&slab->class_locks[c]);
+            for(int i = 0; i < PL_SLAB_CACHE_SIZE / 2; i++) {
+                void *slot = pl_pool_alloc(slab->classes[c]);
+                if(!slot) break;
+                *(void**)slot = cache->lists[c];
+                cache->lists[c] = slot;
+                cache->counts[c]++;
+            }
+            pl_mtx_unlock(&slab->class_locks[c]);
+        }
+
+        ptr = cache->lists[c];
+        if(ptr) {
+            cache->lists[c] = *(void**)ptr;
+            cache->counts[c]--;
+        }
+    }
+
+    if(ptr) _pl_slab_account_internal(slab, cache, (long long)_pl_slab_class_sizes[c]);
+    return ptr;
+}
+
+void pl_slab_free(pl_slab_t *slab, void *ptr, size_t size) {
+    if(!slab || !ptr) return;
+
+    _pl_slab_cache_t *cache = _pl_slab_cache_internal(slab);
+    if(size > PL_SLAB_MAX_SIZE) {
+        free(ptr);
+        _pl_slab_account_internal(slab, cache, -(long long)size);
+        return;
+    }
+
+    int c = _pl_slab_class_internal(size);
+    _pl_slab_account_internal(slab, cache, -(long long)_pl_slab_class_sizes[c]);
+    if(!cache) {
+        pl_mtx_lock(&slab->class_locks[c]);
+        pl_pool_free(slab->classes[c], ptr);
+        pl_mtx_unlock(&slab->class_locks[c]);
+        return;
+    }
+
+    *(void**)ptr = cache->lists[c];
+    cache->lists[c] = ptr;
+    if(++cache->counts[c] > PL_SLAB_CACHE_SIZE) _pl_slab_flush_internal(slab, cache, c, PL_SLAB_CACHE_SIZE / 2);
+}
+
+// 'live_bytes' is exact once other threads are quiet. 'reserved_bytes' covers
+// the size-class slots carved so far; objects over PL_SLAB_MAX_SIZE count
+// towards live and peak only.
+void pl_slab_stats(pl_slab_t *slab, pl_alloc_stats_t *stats) {
+    if(!slab || !stats) return;
+
+    size_t reserved = 0;
+    for(int c = 0; c < PL_SLAB_CLASS_COUNT; c++) {
+        pl_mtx_lock(&slab->class_locks[c]);
+        reserved += slab->classes[c]->carved * slab->classes[c]->slot_size;
+        pl_mtx_unlock(&slab->class_locks[c]);
+    }
+
+    long long live = atomic_load_explicit(&slab->live_bytes, memory_order_relaxed);
+    pl_mtx_lock(&slab->lock);
+    for(_pl_slab_cache_t *cache = slab->caches; cache; cache = cache->next) {
+        live += atomic_load_explicit(&cache->stats_delta, memory_order_relaxed);
+    }
+    pl_mtx_unlock(&slab->lock);
+    long long peak = atomic_load_explicit(&slab->peak_bytes, memory_order_relaxed);
+    if(live < 0) live = 0;
+    if(peak < live) peak = live;
+    _pl_alloc_stats_set_internal(stats, (size_t)live, (size_t)peak, reserved);
+    if(stats->fragmentation < 0.0) stats->fragmentation = 0.0;
+}
+
+// No thread may use the slab after this
+void pl_slab_destroy(pl_slab_t *slab) {
+    if(!slab) return;
+
+    pl_tss_delete(slab->key);
+    _pl_slab_cache_t *cache = slab->caches;
+    while(cache) {
+        _pl_slab_cache_t *next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    for(int c = 0; c < PL_SLAB_CLASS_COUNT; c++) {
+        pl_mtx_destroy(&slab->class_locks[c]);
+        pl_pool_destroy(slab->classes[c]);
+    }
+    pl_mtx_destroy(&slab->lock);
+    free(slab);
 }
 
 #endif // PLATO_ARENA_IMPLEMENTATION
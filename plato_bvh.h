@@ -2,20 +2,80 @@
 #define PLATO_BVH_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 #include <float.h>
 #include <math.h>
+#include "plato_jobs.h"
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+    #define PL_BVH_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PL_BVH_SSE
+#endif
 
 #define PL_BVH_LEAFNODE            -1
 #define PL_BVH_INTERNALNODE_OBJIDX -1
+#define PL_BVH_NO_HIT              -1
+
+#define PL_BVH_SAH_BINS            16
+#define PL_BVH_SAH_MAX_DEPTH       32
+#define PL_BVH_PARALLEL_THRESHOLD  4096
+#define PL_BVH_STACK_SIZE          128
+
+#define PL_BVH_LBVH_MORTON63_THRESHOLD (1 << 20)
+
+#define PL_BVH_UPDATE_ROTATE       1
+
+#define PL_BVH_WIDE_EMPTY          -1
+#define PL_BVH_WIDE_LEAF(obj_idx)  (-(obj_idx) - 2)
+#define PL_BVH_WIDE_OBJIDX(child)  (-(child) - 2)
+#define PL_BVH_WIDE_STACK_SIZE     256
+
+#define PL_BVH_COMPACT_MAX_LEAF_SIZE 16
+#define PL_BVH_COMPACT_TRAVERSAL_COST 2.0f
+#define PL_BVH_QUANTIZED_MAX         65535
+
+#define PL_BVH_FILE_VERSION        1
+#define PL_BVH_LOAD_VERIFY         1
+
+#if defined(PL_BVH_AVX)
+    #define PL_BVH_PACKET_SIZE 8
+#else
+    #define PL_BVH_PACKET_SIZE 4
+#endif
 
 typedef struct pl_bvh_s pl_bvh_t;
 typedef struct pl_bvh_node_s pl_bvh_node_t;
 typedef struct pl_bvh_aabb_s pl_bvh_aabb_t;
+typedef struct pl_bvh_links_s pl_bvh_links_t;
+typedef struct pl_bvh4_node_s pl_bvh4_node_t;
+typedef struct pl_bvh8_node_s pl_bvh8_node_t;
+typedef struct pl_bvh_wide_s pl_bvh_wide_t;
+typedef struct pl_bvh_compact_node_s pl_bvh_compact_node_t;
+typedef struct pl_bvh_compact_s pl_bvh_compact_t;
+typedef struct pl_bvh_qnode_s pl_bvh_qnode_t;
+typedef struct pl_bvh_quantized_s pl_bvh_quantized_t;
+typedef struct pl_bvh_mapping_s pl_bvh_mapping_t;
 
 void pl_bvh_init(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count);
+void pl_bvh_init_parallel(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count, pl_jobs_t *jobs);
+void pl_bvh_init_lbvh(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count);
 void pl_bvh_print(pl_bvh_t *bvh);
+int pl_bvh_refit(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count);
+int pl_bvh_links_init(pl_bvh_links_t *links, pl_bvh_t *bvh);
+void pl_bvh_links_free(pl_bvh_links_t *links);
+int pl_bvh_update(
+    pl_bvh_t *bvh,
+    pl_bvh_links_t *links,
+    int obj_idx,
+    pl_bvh_aabb_t *aabb,
+    int flags
+);
 int pl_bvh_ray_intersection(
     pl_bvh_t *bvh, 
     float ray_origin[3], 
@@ -25,9 +85,94 @@ int pl_bvh_ray_intersection(
     int *dest, 
     size_t dest_sz
 );
+int pl_bvh_ray_closest(
+    pl_bvh_t *bvh,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    float *dist
+);
+int pl_bvh_ray_any(
+    pl_bvh_t *bvh,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3]
+);
+int pl_bvh_query_aabb(pl_bvh_t *bvh, pl_bvh_aabb_t *aabb, int *dest, size_t dest_sz);
+int pl_bvh_query_sphere(pl_bvh_t *bvh, float center[3], float radius, int *dest, size_t dest_sz);
+int pl_bvh_knn(pl_bvh_t *bvh, float point[3], int k, int *dest, float *dest_dist);
+int pl_bvh_query_pairs(pl_bvh_t *bvh_a, pl_bvh_t *bvh_b, int *dest, size_t dest_sz);
+int pl_bvh_ray_intersection_batch(
+    pl_bvh_t *bvh,
+    float (*ray_origins)[3],
+    float (*ray_dirs)[3],
+    size_t ray_count,
+    float ray_range,
+    float padding[3],
+    int *offsets,
+    int *dest,
+    size_t dest_sz
+);
+int pl_bvh_wide_init(pl_bvh_wide_t *wide, pl_bvh_t *bvh, int width);
+void pl_bvh_wide_free(pl_bvh_wide_t *wide);
+int pl_bvh_wide_ray_intersection(
+    pl_bvh_wide_t *wide,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+);
+int pl_bvh_compact_init(pl_bvh_compact_t *compact, pl_bvh_aabb_t *aabbs, size_t aabb_count, int max_leaf_size);
+void pl_bvh_compact_free(pl_bvh_compact_t *compact);
+int pl_bvh_compact_ray_intersection(
+    pl_bvh_compact_t *compact,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+);
+int pl_bvh_quantized_init(pl_bvh_quantized_t *quantized, pl_bvh_compact_t *compact);
+void pl_bvh_quantized_free(pl_bvh_quantized_t *quantized);
+uint64_t pl_bvh_checksum(const void *data, size_t size);
+int pl_bvh_save(pl_bvh_t *bvh, const char *path, uint64_t source_checksum);
+int pl_bvh_load_mmap(
+    pl_bvh_t *bvh,
+    pl_bvh_mapping_t *mapping,
+    const char *path,
+    uint64_t source_checksum,
+    int flags
+);
+void pl_bvh_unload(pl_bvh_mapping_t *mapping);
+int pl_bvh_quantized_ray_intersection(
+    pl_bvh_quantized_t *quantized,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+);
 
 #if defined(PLATO_IMPLEMENTATION) || defined(PLATO_BVH_IMPLEMENTATION)
 
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 typedef struct pl_bvh_aabb_s {
     float min[3];
     float max[3];
@@ -50,62 +195,137 @@ typedef struct pl_bvh_s {
     int node_count;
 } pl_bvh_t;
 
-static void _pl_bvh_swap_internal(void *a, void *b, size_t size) {
-    unsigned char *pa = (unsigned char*)a;
-    unsigned char *pb = (unsigned char*)b; 
-    unsigned char tmp;
-    while(size--) {
-        tmp = *pa;
-        *pa++ = *pb;
-        *pb++ = tmp;
-    }
+// Parent of every node and leaf of every object, needed to walk up from a
+// single object in pl_bvh_update. Rebuild after re-initializing the tree.
+typedef struct pl_bvh_links_s {
+    int *parents;
+    int *leaves;
+    int node_count;
+    int leaf_count;
+} pl_bvh_links_t;
+
+// Collapsed 4-/8-ary nodes with child bounds stored per axis (SoA) so one
+// SIMD slab test covers every child. Children are a wide node index (>= 0),
+// PL_BVH_WIDE_LEAF(obj_idx) or PL_BVH_WIDE_EMPTY.
+typedef struct pl_bvh4_node_s {
+    float min_x[4], min_y[4], min_z[4];
+    float max_x[4], max_y[4], max_z[4];
+    int child[4];
+} pl_bvh4_node_t;
+
+typedef struct pl_bvh8_node_s {
+    float min_x[8], min_y[8], min_z[8];
+    float max_x[8], max_y[8], max_z[8];
+    int child[8];
+} pl_bvh8_node_t;
+
+typedef struct pl_bvh_wide_s {
+    void *nodes;
+    int node_count;
+    int width;
+} pl_bvh_wide_t;
+
+// 32-byte node in depth-first order: the left child of an internal node is
+// the next node and 'offset' is the right child. Leaves (count > 0) cover
+// prim_indices[offset, offset + count). The node array is 32-byte aligned
+// so a node never straddles a cache line.
+typedef struct pl_bvh_compact_node_s {
+    float min[3];
+    float max[3];
+    int32_t offset;
+    int32_t count;
+} pl_bvh_compact_node_t;
+
+typedef struct pl_bvh_compact_s {
+    pl_bvh_compact_node_t *nodes;
+    int *prim_indices;
+    int node_count;
+    int prim_count;
+} pl_bvh_compact_t;
+
+// 16-byte node with bounds quantized to the scene bounds, rounded outwards.
+// 'data' is the right child, or for leaves the high bit set with the first
+// primitive above the low four bits holding count - 1.
+typedef struct pl_bvh_qnode_s {
+    uint16_t min[3];
+    uint16_t max[3];
+    uint32_t data;
+} pl_bvh_qnode_t;
+
+// A file mapped by pl_bvh_load_mmap; release it with pl_bvh_unload once the
+// tree is no longer used
+typedef struct pl_bvh_mapping_s {
+    void *base;
+    size_t size;
+#if defined(_WIN32)
+    HANDLE file;
+    HANDLE map;
+#endif
+} pl_bvh_mapping_t;
+
+typedef struct pl_bvh_quantized_s {
+    pl_bvh_qnode_t *nodes;
+    int *prim_indices;
+    int node_count;
+    int prim_count;
+    float origin[3];
+    float scale[3];
+} pl_bvh_quantized_t;
+
+static inline float _pl_bvh_center_internal(const pl_bvh_aabb_t *aabb, int axis) {
+    return (aabb->min[axis] + aabb->max[axis]) * 0.5f;
 }
 
-static void *_pl_bvh_partition_internal(
-    void *base, 
-    size_t num, 
-    size_t size, 
-    int (*cmp)(const void*, const void*, void*), 
-    void *arg
-) {
-    unsigned char *arr = (unsigned char*)base;
-    void *pivot = arr + (num - 1) * size;
-    size_t i = 0;
+static inline float _pl_bvh_area_internal(const float min[3], const float max[3]) {
+    float dx = max[0] - min[0];
+    float dy = max[1] - min[1];
+    float dz = max[2] - min[2];
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
 
-    for(size_t j = 0; j < num - 1; j++) {
-        if (cmp(arr + j * size, pivot, arg) < 0) {
-            _pl_bvh_swap_internal(arr + i * size, arr + j * size, size);
-            i++;
-        }
+static inline void _pl_bvh_aabb_reset_internal(pl_bvh_aabb_t *aabb) {
+    aabb->min[0] = aabb->min[1] = aabb->min[2] =  FLT_MAX;
+    aabb->max[0] = aabb->max[1] = aabb->max[2] = -FLT_MAX;
+}
+
+static inline void _pl_bvh_aabb_grow_internal(pl_bvh_aabb_t *aabb, const pl_bvh_aabb_t *other) {
+    for(int j = 0; j < 3; j++) {
+        if(other->min[j] < aabb->min[j]) aabb->min[j] = other->min[j];
+        if(other->max[j] > aabb->max[j]) aabb->max[j] = other->max[j];
     }
-    _pl_bvh_swap_internal(arr + i * size, pivot, size);
-    return arr + i * size;
 }
 
-static void _pl_bvh_qsortr_internal(
-    void *base, 
-    size_t num, 
-    size_t size, 
-    int (*cmp)(const void*, const void*, void*), 
-    void *arg
-) {
-    if(num < 2) return;
+static inline void _pl_bvh_swap_internal(_pl_bvh_indexed_aabb_t *a, _pl_bvh_indexed_aabb_t *b) {
+    _pl_bvh_indexed_aabb_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
 
-    unsigned char *arr = (unsigned char*)base;
-    void *p = _pl_bvh_partition_internal(arr, num, size, cmp, arg);
-    size_t pivot_index = (p - (void *)arr) / size;
+// Quickselect on AABB centers so that 'nth' ends up in its sorted position
+static void _pl_bvh_nth_element_internal(_pl_bvh_indexed_aabb_t *items, int start, int end, int nth, int axis) {
+    while(end - start > 1) {
+        int mid = start + (end - start) / 2;
+        float a = _pl_bvh_center_internal(&items[start].aabb, axis);
+        float b = _pl_bvh_center_internal(&items[mid].aabb, axis);
+        float c = _pl_bvh_center_internal(&items[end - 1].aabb, axis);
+        float pivot = (a < b) ? ((b < c) ? b : ((a < c) ? c : a)) : ((a < c) ? a : ((b < c) ? c : b));
 
-    _pl_bvh_qsortr_internal(arr, pivot_index, size, cmp, arg);
-    _pl_bvh_qsortr_internal(arr + (pivot_index + 1) * size, num - pivot_index - 1, size, cmp, arg);
-}
+        int i = start;
+        int j = end - 1;
+        while(i <= j) {
+            while(_pl_bvh_center_internal(&items[i].aabb, axis) < pivot) i++;
+            while(_pl_bvh_center_internal(&items[j].aabb, axis) > pivot) j--;
+            if(i <= j) {
+                _pl_bvh_swap_internal(&items[i], &items[j]);
+                i++;
+                j--;
+            }
+        }
 
-static int _pl_bvh_compare_aabbs_internal(const void *a, const void *b, void *axis_ptr) {
-    int axis = *(int*)axis_ptr;
-    const _pl_bvh_indexed_aabb_t *aabb0 = (const _pl_bvh_indexed_aabb_t*)a;
-    const _pl_bvh_indexed_aabb_t *aabb1 = (const _pl_bvh_indexed_aabb_t*)b;
-    float centerA = (aabb0->aabb.min[axis] + aabb0->aabb.max[axis]) * 0.5f;
-    float centerB = (aabb1->aabb.min[axis] + aabb1->aabb.max[axis]) * 0.5f;
-    return (centerA > centerB) - (centerA < centerB);
+        if(nth <= j) end = j + 1;
+        else if(nth >= i) start = i;
+        else return;
+    }
 }
 
 static void _pl_bvh_print_internal(pl_bvh_t *bvh, int node_idx, int depth) {
@@ -128,87 +348,583 @@ void pl_bvh_print(pl_bvh_t *bvh) {
     _pl_bvh_print_internal(bvh, 0, 0);
 }
 
-static int _pl_build_bvh_internal(
-    pl_bvh_node_t *nodes, 
-    _pl_bvh_indexed_aabb_t *indexed_aabbs, 
-    int start, 
-    int end, 
-    int *node_count
-) {
-    int count = end - start;
-    int node_idx = (*node_count)++;
-    pl_bvh_node_t *node = &nodes[node_idx];
+typedef struct _pl_bvh_build_s {
+    pl_bvh_node_t *nodes;
+    _pl_bvh_indexed_aabb_t *items;
+    pl_jobs_t *jobs;
+} _pl_bvh_build_t;
 
-    node->aabb.min[0] = node->aabb.min[1] = node->aabb.min[2] =  FLT_MAX;
-    node->aabb.max[0] = node->aabb.max[1] = node->aabb.max[2] = -FLT_MAX;
+typedef struct _pl_bvh_build_task_s {
+    _pl_bvh_build_t *build;
+    int node_idx;
+    int start;
+    int end;
+    int depth;
+} _pl_bvh_build_task_t;
+
+static void _pl_build_bvh_internal(_pl_bvh_build_t *build, int node_idx, int start, int end, int depth);
+
+static void _pl_build_bvh_job_internal(void *arg) {
+    _pl_bvh_build_task_t *task = (_pl_bvh_build_task_t*)arg;
+    _pl_build_bvh_internal(task->build, task->node_idx, task->start, task->end, task->depth);
+}
+
+// Picks the cheapest binned SAH split and partitions [start, end) around it.
+// Returns the first index of the right half, or -1 if no bin split exists.
+// The unnormalized split cost is written to 'split_cost' if not NULL.
+static int _pl_bvh_sah_split_internal(_pl_bvh_indexed_aabb_t *items, int start, int end, float *split_cost) {
+    pl_bvh_aabb_t centers;
+    _pl_bvh_aabb_reset_internal(&centers);
     for(int i = start; i < end; i++) {
         for(int j = 0; j < 3; j++) {
-            if(indexed_aabbs[i].aabb.min[j] < node->aabb.min[j]) 
-                node->aabb.min[j] = indexed_aabbs[i].aabb.min[j];
-            if(indexed_aabbs[i].aabb.max[j] > node->aabb.max[j]) 
-                node->aabb.max[j] = indexed_aabbs[i].aabb.max[j];
+            float c = _pl_bvh_center_internal(&items[i].aabb, j);
+            if(c < centers.min[j]) centers.min[j] = c;
+            if(c > centers.max[j]) centers.max[j] = c;
+        }
+    }
+
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    int best_bin = 0;
+
+    for(int axis = 0; axis < 3; axis++) {
+        float extent = centers.max[axis] - centers.min[axis];
+        if(extent <= 0.0f) continue;
+        float scale = (float)PL_BVH_SAH_BINS / extent;
+
+        pl_bvh_aabb_t bins[PL_BVH_SAH_BINS];
+        int counts[PL_BVH_SAH_BINS] = {0};
+        for(int b = 0; b < PL_BVH_SAH_BINS; b++) _pl_bvh_aabb_reset_internal(&bins[b]);
+
+        for(int i = start; i < end; i++) {
+            int b = (int)((_pl_bvh_center_internal(&items[i].aabb, axis) - centers.min[axis]) * scale);
+            if(b >= PL_BVH_SAH_BINS) b = PL_BVH_SAH_BINS - 1;
+            counts[b]++;
+            _pl_bvh_aabb_grow_internal(&bins[b], &items[i].aabb);
+        }
+
+        // Sweep from the right to get the suffix areas, then from the left to score each plane
+        float right_area[PL_BVH_SAH_BINS];
+        int right_count[PL_BVH_SAH_BINS];
+        pl_bvh_aabb_t acc;
+        _pl_bvh_aabb_reset_internal(&acc);
+        int n = 0;
+        for(int b = PL_BVH_SAH_BINS - 1; b > 0; b--) {
+            if(counts[b]) _pl_bvh_aabb_grow_internal(&acc, &bins[b]);
+            n += counts[b];
+            right_count[b] = n;
+            right_area[b] = n ? _pl_bvh_area_internal(acc.min, acc.max) : 0.0f;
+        }
+
+        _pl_bvh_aabb_reset_internal(&acc);
+        n = 0;
+        for(int b = 0; b < PL_BVH_SAH_BINS - 1; b++) {
+            if(counts[b]) _pl_bvh_aabb_grow_internal(&acc, &bins[b]);
+            n += counts[b];
+            if(n == 0 || right_count[b + 1] == 0) continue;
+
+            float cost = _pl_bvh_area_internal(acc.min, acc.max) * (float)n
+                       + right_area[b + 1] * (float)right_count[b + 1];
+            if(cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
         }
     }
 
+    if(best_axis < 0) return -1;
+    if(split_cost) *split_cost = best_cost;
+
+    float scale = (float)PL_BVH_SAH_BINS / (centers.max[best_axis] - centers.min[best_axis]);
+    int i = start;
+    int j = end - 1;
+    while(i <= j) {
+        int b = (int)((_pl_bvh_center_internal(&items[i].aabb, best_axis) - centers.min[best_axis]) * scale);
+        if(b >= PL_BVH_SAH_BINS) b = PL_BVH_SAH_BINS - 1;
+        if(b <= best_bin) i++;
+        else _pl_bvh_swap_internal(&items[i], &items[j--]);
+    }
+
+    if(i == start || i == end) return -1;
+    return i;
+}
+
+static void _pl_build_bvh_internal(_pl_bvh_build_t *build, int node_idx, int start, int end, int depth) {
+    _pl_bvh_indexed_aabb_t *items = build->items;
+    pl_bvh_node_t *node = &build->nodes[node_idx];
+    int count = end - start;
+
+    _pl_bvh_aabb_reset_internal(&node->aabb);
+    for(int i = start; i < end; i++) _pl_bvh_aabb_grow_internal(&node->aabb, &items[i].aabb);
+
     if(count == 1) {
         node->left =  PL_BVH_LEAFNODE;
         node->right = PL_BVH_LEAFNODE;
-        node->obj_idx = indexed_aabbs[start].idx;
+        node->obj_idx = items[start].idx;
+        return;
     }
-    else {
+
+    // Past the depth limit fall back to median splits so the tree stays
+    // shallow enough for the fixed-size traversal stacks
+    int mid = -1;
+    if(depth < PL_BVH_SAH_MAX_DEPTH) mid = _pl_bvh_sah_split_internal(items, start, end, NULL);
+    if(mid < 0) {
         float extent[3] = {
             node->aabb.max[0] - node->aabb.min[0],
             node->aabb.max[1] - node->aabb.min[1],
             node->aabb.max[2] - node->aabb.min[2]
         };
-
         int axis = (extent[0] > extent[1] && extent[0] > extent[2]) ? 0 : (extent[1] > extent[2] ? 1 : 2);
-        _pl_bvh_qsortr_internal(
-            indexed_aabbs + start, 
-            count, 
-            sizeof(_pl_bvh_indexed_aabb_t),
-            _pl_bvh_compare_aabbs_internal,
-            &axis
-        );
-
-        int mid = start + count / 2;
-        node->left  = _pl_build_bvh_internal(nodes, indexed_aabbs, start, mid, node_count);
-        node->right = _pl_build_bvh_internal(nodes, indexed_aabbs, mid, end, node_count);
-        node->obj_idx = PL_BVH_INTERNALNODE_OBJIDX;
+        mid = start + count / 2;
+        _pl_bvh_nth_element_internal(items, start, end, mid, axis);
     }
 
-    return node_idx;
+    // Each subtree over n objects holds exactly 2n - 1 nodes, so both child
+    // slots are known up front and the halves can be built independently
+    int left_idx = node_idx + 1;
+    int right_idx = node_idx + 2 * (mid - start);
+    node->left = left_idx;
+    node->right = right_idx;
+    node->obj_idx = PL_BVH_INTERNALNODE_OBJIDX;
+
+    if(build->jobs && count >= PL_BVH_PARALLEL_THRESHOLD) {
+        _pl_bvh_build_task_t task = {build, left_idx, start, mid, depth + 1};
+        pl_jobs_counter_t counter;
+        pl_jobs_counter_init(&counter);
+        if(pl_jobs_run(build->jobs, _pl_build_bvh_job_internal, &task, &counter) != 0) {
+            _pl_build_bvh_job_internal(&task);
+        }
+        _pl_build_bvh_internal(build, right_idx, mid, end, depth + 1);
+        pl_jobs_wait(build->jobs, &counter);
+    }
+    else {
+        _pl_build_bvh_internal(build, left_idx, start, mid, depth + 1);
+        _pl_build_bvh_internal(build, right_idx, mid, end, depth + 1);
+    }
 }
 
 void pl_bvh_init(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count) {
+    pl_bvh_init_parallel(bvh, aabbs, aabb_count, NULL);
+}
+
+void pl_bvh_init_parallel(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count, pl_jobs_t *jobs) {
     if(aabb_count <= 0) {
         bvh->node_count = 0;
         return;
     }
 
     _pl_bvh_indexed_aabb_t *indexed_aabbs = malloc(sizeof(_pl_bvh_indexed_aabb_t) * aabb_count);
+    if(!indexed_aabbs) {
+        bvh->node_count = 0;
+        return;
+    }
     for(size_t i = 0; i < aabb_count; i++) {
         indexed_aabbs[i].idx = (int)i;
         indexed_aabbs[i].aabb = aabbs[i];
     }
 
-    _pl_build_bvh_internal(bvh->nodes, indexed_aabbs, 0, aabb_count, &bvh->node_count);
+    _pl_bvh_build_t build = {bvh->nodes, indexed_aabbs, jobs};
+    _pl_build_bvh_internal(&build, 0, 0, (int)aabb_count, 0);
+    bvh->node_count = (int)(2 * aabb_count - 1);
     free(indexed_aabbs);
 }
 
+static inline uint64_t _pl_bvh_expand_bits_internal(uint64_t v, int bits) {
+    // Spreads the low 10 (or 21) bits of v so there are two zero bits between each
+    if(bits == 10) {
+        v &= 0x3FF;
+        v = (v | (v << 16)) & 0x30000FF;
+        v = (v | (v <<  8)) & 0x300F00F;
+        v = (v | (v <<  4)) & 0x30C30C3;
+        v = (v | (v <<  2)) & 0x9249249;
+    }
+    else {
+        v &= 0x1FFFFF;
+        v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+        v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+        v = (v | (v <<  8)) & 0x100F00F00F00F00FULL;
+        v = (v | (v <<  4)) & 0x10C30C30C30C30C3ULL;
+        v = (v | (v <<  2)) & 0x1249249249249249ULL;
+    }
+    return v;
+}
+
+static inline int _pl_bvh_clz64_internal(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return v ? __builtin_clzll(v) : 64;
+#else
+    int n = 0;
+    if(!v) return 64;
+    while(!(v & 0x8000000000000000ULL)) {
+        v <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// LSD radix sort of (code, index) pairs with 11-bit digits, skipping digits
+// that are identical for every key. The result always ends up in 'keys'.
+static void _pl_bvh_radix_sort_internal(
+    uint64_t *keys,
+    int *vals,
+    uint64_t *tmp_keys,
+    int *tmp_vals,
+    size_t count,
+    int key_bits
+) {
+    size_t hist[2048];
+    int passes = (key_bits + 10) / 11;
+    int swapped = 0;
+
+    for(int pass = 0; pass < passes; pass++) {
+        int shift = pass * 11;
+        memset(hist, 0, sizeof(hist));
+        for(size_t i = 0; i < count; i++) hist[(keys[i] >> shift) & 0x7FF]++;
+        if(hist[(keys[0] >> shift) & 0x7FF] == count) continue;
+
+        size_t sum = 0;
+        for(int d = 0; d < 2048; d++) {
+            size_t c = hist[d];
+            hist[d] = sum;
+            sum += c;
+        }
+        for(size_t i = 0; i < count; i++) {
+            size_t dst = hist[(keys[i] >> shift) & 0x7FF]++;
+            tmp_keys[dst] = keys[i];
+            tmp_vals[dst] = vals[i];
+        }
+
+        swapped = !swapped;
+        uint64_t *swap_keys = keys;
+        keys = tmp_keys;
+        tmp_keys = swap_keys;
+        int *swap_vals = vals;
+        vals = tmp_vals;
+        tmp_vals = swap_vals;
+    }
+
+    if(swapped) {
+        memcpy(tmp_keys, keys, sizeof(uint64_t) * count);
+        memcpy(tmp_vals, vals, sizeof(int) * count);
+    }
+}
+
+// Length of the common prefix of the sorted codes at i and j, with the
+// index as a tie breaker for duplicate codes (Karras 2012)
+static inline int _pl_bvh_lbvh_delta_internal(const uint64_t *codes, int count, int i, int j) {
+    if(j < 0 || j >= count) return -1;
+    if(codes[i] == codes[j]) return 64 + _pl_bvh_clz64_internal((uint64_t)(i ^ j) << 32);
+    return _pl_bvh_clz64_internal(codes[i] ^ codes[j]);
+}
+
+void pl_bvh_init_lbvh(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count) {
+    if(aabb_count <= 0) {
+        bvh->node_count = 0;
+        return;
+    }
+
+    int count = (int)aabb_count;
+    if(count == 1) {
+        bvh->nodes[0].aabb = aabbs[0];
+        bvh->nodes[0].left = PL_BVH_LEAFNODE;
+        bvh->nodes[0].right = PL_BVH_LEAFNODE;
+        bvh->nodes[0].obj_idx = 0;
+        bvh->node_count = 1;
+        return;
+    }
+
+    size_t mem_sz = (sizeof(uint64_t) * 2 + sizeof(int) * 2) * aabb_count
+                  + sizeof(int) * (2 * aabb_count - 1)
+                  + sizeof(unsigned char) * aabb_count;
+    unsigned char *mem = malloc(mem_sz);
+    if(!mem) {
+        bvh->node_count = 0;
+        return;
+    }
+    uint64_t *codes = (uint64_t*)mem;
+    uint64_t *tmp_codes = codes + aabb_count;
+    int *order = (int*)(tmp_codes + aabb_count);
+    int *tmp_order = order + aabb_count;
+    int *parents = tmp_order + aabb_count;
+    unsigned char *visited = (unsigned char*)(parents + 2 * aabb_count - 1);
+
+    pl_bvh_aabb_t centers;
+    _pl_bvh_aabb_reset_internal(&centers);
+    for(int i = 0; i < count; i++) {
+        for(int j = 0; j < 3; j++) {
+            float c = _pl_bvh_center_internal(&aabbs[i], j);
+            if(c < centers.min[j]) centers.min[j] = c;
+            if(c > centers.max[j]) centers.max[j] = c;
+        }
+    }
+
+    int axis_bits = (aabb_count > PL_BVH_LBVH_MORTON63_THRESHOLD) ? 21 : 10;
+    float grid = (float)((1u << axis_bits) - 1);
+    float scale[3];
+    for(int j = 0; j < 3; j++) {
+        float extent = centers.max[j] - centers.min[j];
+        scale[j] = extent > 0.0f ? grid / extent : 0.0f;
+    }
+
+    for(int i = 0; i < count; i++) {
+        uint64_t code = 0;
+        for(int j = 0; j < 3; j++) {
+            uint64_t q = (uint64_t)((_pl_bvh_center_internal(&aabbs[i], j) - centers.min[j]) * scale[j]);
+            code |= _pl_bvh_expand_bits_internal(q, axis_bits) << (2 - j);
+        }
+        codes[i] = code;
+        order[i] = i;
+    }
+
+    _pl_bvh_radix_sort_internal(codes, order, tmp_codes, tmp_order, aabb_count, axis_bits * 3);
+
+    // Internal node i lives at nodes[i] (root at 0), leaf i at nodes[count - 1 + i]
+    pl_bvh_node_t *nodes = bvh->nodes;
+    int leaf_base = count - 1;
+    parents[0] = -1;
+
+    for(int i = 0; i < count - 1; i++) {
+        int d = (_pl_bvh_lbvh_delta_internal(codes, count, i, i + 1) -
+                 _pl_bvh_lbvh_delta_internal(codes, count, i, i - 1)) >= 0 ? 1 : -1;
+        int delta_min = _pl_bvh_lbvh_delta_internal(codes, count, i, i - d);
+
+        int l_max = 2;
+        while(_pl_bvh_lbvh_delta_internal(codes, count, i, i + l_max * d) > delta_min) l_max *= 2;
+
+        int l = 0;
+        for(int t = l_max / 2; t >= 1; t /= 2) {
+            if(_pl_bvh_lbvh_delta_internal(codes, count, i, i + (l + t) * d) > delta_min) l += t;
+        }
+        int j = i + l * d;
+
+        int delta_node = _pl_bvh_lbvh_delta_internal(codes, count, i, j);
+        int s = 0;
+        int div = 2;
+        int t;
+        do {
+            t = (l + div - 1) / div;
+            if(_pl_bvh_lbvh_delta_internal(codes, count, i, i + (s + t) * d) > delta_node) s += t;
+            div *= 2;
+        } while(t > 1);
+        int gamma = i + s * d + (d < 0 ? -1 : 0);
+
+        int lo = i < j ? i : j;
+        int hi = i < j ? j : i;
+        int left = (lo == gamma) ? leaf_base + gamma : gamma;
+        int right = (hi == gamma + 1) ? leaf_base + gamma + 1 : gamma + 1;
+
+        nodes[i].left = left;
+        nodes[i].right = right;
+        nodes[i].obj_idx = PL_BVH_INTERNALNODE_OBJIDX;
+        parents[left] = i;
+        parents[right] = i;
+        visited[i] = 0;
+    }
+
+    // Climb from every leaf; the second child to arrive at a node fills its bounds
+    for(int i = 0; i < count; i++) {
+        pl_bvh_node_t *leaf = &nodes[leaf_base + i];
+        leaf->aabb = aabbs[order[i]];
+        leaf->left = PL_BVH_LEAFNODE;
+        leaf->right = PL_BVH_LEAFNODE;
+        leaf->obj_idx = order[i];
+
+        int parent = parents[leaf_base + i];
+        while(parent >= 0) {
+            if(!visited[parent]) {
+                visited[parent] = 1;
+                break;
+            }
+            pl_bvh_node_t *node = &nodes[parent];
+            node->aabb = nodes[node->left].aabb;
+            _pl_bvh_aabb_grow_internal(&node->aabb, &nodes[node->right].aabb);
+            parent = parents[parent];
+        }
+    }
+
+    bvh->node_count = 2 * count - 1;
+    free(mem);
+}
+
+int pl_bvh_refit(pl_bvh_t *bvh, pl_bvh_aabb_t *aabbs, size_t aabb_count) {
+    if(!bvh || !aabbs) return 1;
+    if(bvh->node_count == 0) return 0;
+
+    // Iterative post-order walk so children are always refit before their
+    // parent, regardless of how the builder or rotations laid out the nodes
+    pl_bvh_node_t *nodes = bvh->nodes;
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+    int node_idx = 0;
+    int last = -1;
+
+    while(stack_ptr > 0 || node_idx >= 0) {
+        if(node_idx >= 0) {
+            pl_bvh_node_t *node = &nodes[node_idx];
+            if(node->left == PL_BVH_LEAFNODE) {
+                if((size_t)node->obj_idx >= aabb_count) return 1;
+                node->aabb = aabbs[node->obj_idx];
+                last = node_idx;
+                node_idx = -1;
+            }
+            else {
+                if(stack_ptr >= PL_BVH_STACK_SIZE) return 1;
+                stack[stack_ptr++] = node_idx;
+                node_idx = node->left;
+            }
+        }
+        else {
+            pl_bvh_node_t *node = &nodes[stack[stack_ptr - 1]];
+            if(node->right != last) node_idx = node->right;
+            else {
+                node->aabb = nodes[node->left].aabb;
+                _pl_bvh_aabb_grow_internal(&node->aabb, &nodes[node->right].aabb);
+                last = stack[--stack_ptr];
+            }
+        }
+    }
+
+    return 0;
+}
+
+int pl_bvh_links_init(pl_bvh_links_t *links, pl_bvh_t *bvh) {
+    if(!links || !bvh) return 1;
+
+    links->node_count = bvh->node_count;
+    links->leaf_count = (bvh->node_count + 1) / 2;
+    links->parents = malloc(sizeof(int) * (bvh->node_count > 0 ? bvh->node_count : 1));
+    links->leaves = malloc(sizeof(int) * (links->leaf_count > 0 ? links->leaf_count : 1));
+    if(!links->parents || !links->leaves) {
+        pl_bvh_links_free(links);
+        return 1;
+    }
+
+    if(bvh->node_count > 0) links->parents[0] = -1;
+    for(int i = 0; i < bvh->node_count; i++) {
+        pl_bvh_node_t *node = &bvh->nodes[i];
+        if(node->left == PL_BVH_LEAFNODE) {
+            if(node->obj_idx >= 0 && node->obj_idx < links->leaf_count) links->leaves[node->obj_idx] = i;
+        }
+        else {
+            links->parents[node->left] = i;
+            links->parents[node->right] = i;
+        }
+    }
+
+    return 0;
+}
+
+void pl_bvh_links_free(pl_bvh_links_t *links) {
+    if(!links) return;
+    free(links->parents);
+    free(links->leaves);
+    links->parents = NULL;
+    links->leaves = NULL;
+    links->node_count = 0;
+    links->leaf_count = 0;
+}
+
+// Tries the four child/grandchild swaps under 'node_idx' and applies the one
+// that shrinks the surface area of the regrouped child the most
+static void _pl_bvh_rotate_internal(pl_bvh_t *bvh, pl_bvh_links_t *links, int node_idx) {
+    pl_bvh_node_t *nodes = bvh->nodes;
+    pl_bvh_node_t *node = &nodes[node_idx];
+    if(node->left == PL_BVH_LEAFNODE) return;
+
+    float best_gain = 0.0f;
+    int best_child = -1;
+    int best_grandchild = -1;
+
+    for(int side = 0; side < 2; side++) {
+        int keep = side ? node->right : node->left;
+        int other = side ? node->left : node->right;
+        pl_bvh_node_t *sub = &nodes[other];
+        if(sub->left == PL_BVH_LEAFNODE) continue;
+
+        float area = _pl_bvh_area_internal(sub->aabb.min, sub->aabb.max);
+        for(int g = 0; g < 2; g++) {
+            int grandchild = g ? sub->right : sub->left;
+            int sibling = g ? sub->left : sub->right;
+
+            // 'keep' swaps places with 'grandchild' and joins 'sibling' under 'other'
+            pl_bvh_aabb_t merged = nodes[keep].aabb;
+            _pl_bvh_aabb_grow_internal(&merged, &nodes[sibling].aabb);
+            float gain = area - _pl_bvh_area_internal(merged.min, merged.max);
+            if(gain > best_gain) {
+                best_gain = gain;
+                best_child = keep;
+                best_grandchild = grandchild;
+            }
+        }
+    }
+
+    if(best_child < 0) return;
+
+    int other = (best_child == node->left) ? node->right : node->left;
+    pl_bvh_node_t *sub = &nodes[other];
+
+    if(node->left == best_child) node->left = best_grandchild;
+    else node->right = best_grandchild;
+    if(sub->left == best_grandchild) sub->left = best_child;
+    else sub->right = best_child;
+
+    links->parents[best_grandchild] = node_idx;
+    links->parents[best_child] = other;
+
+    sub->aabb = nodes[sub->left].aabb;
+    _pl_bvh_aabb_grow_internal(&sub->aabb, &nodes[sub->right].aabb);
+}
+
+int pl_bvh_update(
+    pl_bvh_t *bvh,
+    pl_bvh_links_t *links,
+    int obj_idx,
+    pl_bvh_aabb_t *aabb,
+    int flags
+) {
+    if(!bvh || !links || !aabb) return 1;
+    if(obj_idx < 0 || obj_idx >= links->leaf_count) return 1;
+
+    pl_bvh_node_t *nodes = bvh->nodes;
+    int node_idx = links->leaves[obj_idx];
+    nodes[node_idx].aabb = *aabb;
+
+    int parent = links->parents[node_idx];
+    while(parent >= 0) {
+        pl_bvh_node_t *node = &nodes[parent];
+        pl_bvh_aabb_t old = node->aabb;
+
+        if(flags & PL_BVH_UPDATE_ROTATE) _pl_bvh_rotate_internal(bvh, links, parent);
+
+        node->aabb = nodes[node->left].aabb;
+        _pl_bvh_aabb_grow_internal(&node->aabb, &nodes[node->right].aabb);
+
+        // Ancestors cannot change once a node's bounds stay the same
+        if(!(flags & PL_BVH_UPDATE_ROTATE) && memcmp(&old, &node->aabb, sizeof(pl_bvh_aabb_t)) == 0) break;
+        parent = links->parents[parent];
+    }
+
+    return 0;
+}
+
+static inline void _pl_bvh_inv_dir_internal(float dir[3], float inv_dir[3]) {
+    inv_dir[0] = (dir[0] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[0];
+    inv_dir[1] = (dir[1] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[1];
+    inv_dir[2] = (dir[2] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[2];
+}
+
+// Writes the entry distance to 't_entry' (if not NULL) on a hit
 static int _pl_bvh_ray_aabb_intersection_internal(
     float origin[3],
-    float dir[3],
+    float inv_dir[3],
     float max_dist,
     float min_aabb[3],
     float max_aabb[3],
-    float padding[3]
+    float padding[3],
+    float *t_entry
 ) {
-    float inv_dir[3];
-    inv_dir[0] = (dir[0] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[0];
-    inv_dir[1] = (dir[1] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[1];
-    inv_dir[2] = (dir[2] == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir[2];
-
     float padded_min[3], padded_max[3];
     padded_min[0] = min_aabb[0] - padding[0];
     padded_min[1] = min_aabb[1] - padding[1];
@@ -236,6 +952,7 @@ static int _pl_bvh_ray_aabb_intersection_internal(
         if(tmin > tmax) return 0;
     }
 
+    if(t_entry) *t_entry = tmin;
     return 1;
 }
 
@@ -250,8 +967,11 @@ int pl_bvh_ray_intersection(
 ) {
     if(!bvh || !dest || bvh->node_count == 0) return 0;
 
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
     int hit_count = 0;
-    int stack[64];
+    int stack[PL_BVH_STACK_SIZE];
     int stack_ptr = 0;
 
     stack[stack_ptr++] = 0;
@@ -261,14 +981,14 @@ int pl_bvh_ray_intersection(
         pl_bvh_node_t *node = &bvh->nodes[node_idx];
 
         if(_pl_bvh_ray_aabb_intersection_internal(
-            ray_origin, ray_dir, ray_range,
-            node->aabb.min, node->aabb.max, padding)){
+            ray_origin, inv_dir, ray_range,
+            node->aabb.min, node->aabb.max, padding, NULL)){
             if(node->left == PL_BVH_LEAFNODE) {
                 if((size_t)hit_count < dest_sz) dest[hit_count] = node->obj_idx;
                 hit_count++;
             }
             else {
-                if(stack_ptr + 2 <= 64) {
+                if(stack_ptr + 2 <= PL_BVH_STACK_SIZE) {
                     stack[stack_ptr++] = node->left;
                     stack[stack_ptr++] = node->right;
                 }
@@ -279,6 +999,1197 @@ int pl_bvh_ray_intersection(
     return hit_count;
 }
 
+int pl_bvh_ray_closest(
+    pl_bvh_t *bvh,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    float *dist
+) {
+    if(!bvh || bvh->node_count == 0) return PL_BVH_NO_HIT;
+
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
+    int best = PL_BVH_NO_HIT;
+    float best_t = ray_range;
+    float t_root;
+    if(!_pl_bvh_ray_aabb_intersection_internal(
+        ray_origin, inv_dir, best_t,
+        bvh->nodes[0].aabb.min, bvh->nodes[0].aabb.max, padding, &t_root)) {
+        return PL_BVH_NO_HIT;
+    }
+
+    int stack[PL_BVH_STACK_SIZE];
+    float stack_t[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr] = 0;
+    stack_t[stack_ptr++] = t_root;
+
+    while(stack_ptr > 0) {
+        --stack_ptr;
+        if(stack_t[stack_ptr] > best_t) continue;
+        pl_bvh_node_t *node = &bvh->nodes[stack[stack_ptr]];
+
+        if(node->left == PL_BVH_LEAFNODE) {
+            if(best == PL_BVH_NO_HIT || stack_t[stack_ptr] < best_t) {
+                best = node->obj_idx;
+                best_t = stack_t[stack_ptr];
+            }
+            continue;
+        }
+
+        // The ray is shortened to the best hit so far, so farther subtrees are culled
+        float t_left, t_right;
+        pl_bvh_node_t *left = &bvh->nodes[node->left];
+        pl_bvh_node_t *right = &bvh->nodes[node->right];
+        int hit_left = _pl_bvh_ray_aabb_intersection_internal(
+            ray_origin, inv_dir, best_t, left->aabb.min, left->aabb.max, padding, &t_left);
+        int hit_right = _pl_bvh_ray_aabb_intersection_internal(
+            ray_origin, inv_dir, best_t, right->aabb.min, right->aabb.max, padding, &t_right);
+
+        if(hit_left && hit_right) {
+            if(stack_ptr + 2 > PL_BVH_STACK_SIZE) continue;
+            int near_first = t_left <= t_right;
+            stack[stack_ptr] = near_first ? node->right : node->left;
+            stack_t[stack_ptr++] = near_first ? t_right : t_left;
+            stack[stack_ptr] = near_first ? node->left : node->right;
+            stack_t[stack_ptr++] = near_first ? t_left : t_right;
+        }
+        else if(hit_left || hit_right) {
+            if(stack_ptr + 1 > PL_BVH_STACK_SIZE) continue;
+            stack[stack_ptr] = hit_left ? node->left : node->right;
+            stack_t[stack_ptr++] = hit_left ? t_left : t_right;
+        }
+    }
+
+    if(dist && best != PL_BVH_NO_HIT) *dist = best_t;
+    return best;
+}
+
+int pl_bvh_ray_any(
+    pl_bvh_t *bvh,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3]
+) {
+    if(!bvh || bvh->node_count == 0) return PL_BVH_NO_HIT;
+
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr++] = 0;
+
+    while(stack_ptr > 0) {
+        pl_bvh_node_t *node = &bvh->nodes[stack[--stack_ptr]];
+        if(!_pl_bvh_ray_aabb_intersection_internal(
+            ray_origin, inv_dir, ray_range,
+            node->aabb.min, node->aabb.max, padding, NULL)) {
+            continue;
+        }
+
+        if(node->left == PL_BVH_LEAFNODE) return node->obj_idx;
+        if(stack_ptr + 2 <= PL_BVH_STACK_SIZE) {
+            stack[stack_ptr++] = node->left;
+            stack[stack_ptr++] = node->right;
+        }
+    }
+
+    return PL_BVH_NO_HIT;
+}
+
+static inline int _pl_bvh_aabb_overlap_internal(const pl_bvh_aabb_t *a, const pl_bvh_aabb_t *b) {
+    return a->min[0] <= b->max[0] && a->max[0] >= b->min[0] &&
+           a->min[1] <= b->max[1] && a->max[1] >= b->min[1] &&
+           a->min[2] <= b->max[2] && a->max[2] >= b->min[2];
+}
+
+static inline float _pl_bvh_point_dist2_internal(const pl_bvh_aabb_t *aabb, const float point[3]) {
+    float dist2 = 0.0f;
+    for(int i = 0; i < 3; i++) {
+        float d = 0.0f;
+        if(point[i] < aabb->min[i]) d = aabb->min[i] - point[i];
+        else if(point[i] > aabb->max[i]) d = point[i] - aabb->max[i];
+        dist2 += d * d;
+    }
+    return dist2;
+}
+
+int pl_bvh_query_aabb(pl_bvh_t *bvh, pl_bvh_aabb_t *aabb, int *dest, size_t dest_sz) {
+    if(!bvh || !aabb || !dest || bvh->node_count == 0) return 0;
+
+    int hit_count = 0;
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr++] = 0;
+
+    while(stack_ptr > 0) {
+        pl_bvh_node_t *node = &bvh->nodes[stack[--stack_ptr]];
+        if(!_pl_bvh_aabb_overlap_internal(&node->aabb, aabb)) continue;
+
+        if(node->left == PL_BVH_LEAFNODE) {
+            if((size_t)hit_count < dest_sz) dest[hit_count] = node->obj_idx;
+            hit_count++;
+        }
+        else if(stack_ptr + 2 <= PL_BVH_STACK_SIZE) {
+            stack[stack_ptr++] = node->left;
+            stack[stack_ptr++] = node->right;
+        }
+    }
+
+    return hit_count;
+}
+
+int pl_bvh_query_sphere(pl_bvh_t *bvh, float center[3], float radius, int *dest, size_t dest_sz) {
+    if(!bvh || !dest || bvh->node_count == 0) return 0;
+
+    float radius2 = radius * radius;
+    int hit_count = 0;
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr++] = 0;
+
+    while(stack_ptr > 0) {
+        pl_bvh_node_t *node = &bvh->nodes[stack[--stack_ptr]];
+        if(_pl_bvh_point_dist2_internal(&node->aabb, center) > radius2) continue;
+
+        if(node->left == PL_BVH_LEAFNODE) {
+            if((size_t)hit_count < dest_sz) dest[hit_count] = node->obj_idx;
+            hit_count++;
+        }
+        else if(stack_ptr + 2 <= PL_BVH_STACK_SIZE) {
+            stack[stack_ptr++] = node->left;
+            stack[stack_ptr++] = node->right;
+        }
+    }
+
+    return hit_count;
+}
+
+static void _pl_bvh_heap_sift_down_internal(float *dist, int *idx, int count, int i) {
+    for(;;) {
+        int largest = i;
+        int l = 2 * i + 1;
+        int r = l + 1;
+        if(l < count && dist[l] > dist[largest]) largest = l;
+        if(r < count && dist[r] > dist[largest]) largest = r;
+        if(largest == i) return;
+
+        float td = dist[i];
+        dist[i] = dist[largest];
+        dist[largest] = td;
+        int ti = idx[i];
+        idx[i] = idx[largest];
+        idx[largest] = ti;
+        i = largest;
+    }
+}
+
+static void _pl_bvh_heap_push_internal(float *dist, int *idx, int count, float d, int obj_idx) {
+    int i = count;
+    while(i > 0) {
+        int parent = (i - 1) / 2;
+        if(dist[parent] >= d) break;
+        dist[i] = dist[parent];
+        idx[i] = idx[parent];
+        i = parent;
+    }
+    dist[i] = d;
+    idx[i] = obj_idx;
+}
+
+// Finds the k objects whose AABBs are closest to 'point'. Results are sorted
+// nearest first; 'dest_dist' (optional) receives the distances. Returns the
+// number of objects found, which is less than k only for small trees.
+int pl_bvh_knn(pl_bvh_t *bvh, float point[3], int k, int *dest, float *dest_dist) {
+    if(!bvh || !dest || k <= 0 || bvh->node_count == 0) return 0;
+
+    // Bounded max-heap on squared distance, stored directly in the output arrays
+    float *heap = dest_dist ? dest_dist : malloc(sizeof(float) * k);
+    if(!heap) return 0;
+    int count = 0;
+
+    int stack[PL_BVH_STACK_SIZE];
+    float stack_d[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr] = 0;
+    stack_d[stack_ptr++] = _pl_bvh_point_dist2_internal(&bvh->nodes[0].aabb, point);
+
+    while(stack_ptr > 0) {
+        --stack_ptr;
+        if(count == k && stack_d[stack_ptr] >= heap[0]) continue;
+        pl_bvh_node_t *node = &bvh->nodes[stack[stack_ptr]];
+
+        if(node->left == PL_BVH_LEAFNODE) {
+            if(count < k) _pl_bvh_heap_push_internal(heap, dest, count++, stack_d[stack_ptr], node->obj_idx);
+            else {
+                heap[0] = stack_d[stack_ptr];
+                dest[0] = node->obj_idx;
+                _pl_bvh_heap_sift_down_internal(heap, dest, count, 0);
+            }
+            continue;
+        }
+
+        float d_left = _pl_bvh_point_dist2_internal(&bvh->nodes[node->left].aabb, point);
+        float d_right = _pl_bvh_point_dist2_internal(&bvh->nodes[node->right].aabb, point);
+        if(stack_ptr + 2 > PL_BVH_STACK_SIZE) continue;
+
+        // Push the farther child first so the nearer one is expanded next
+        int near_first = d_left <= d_right;
+        stack[stack_ptr] = near_first ? node->right : node->left;
+        stack_d[stack_ptr++] = near_first ? d_right : d_left;
+        stack[stack_ptr] = near_first ? node->left : node->right;
+        stack_d[stack_ptr++] = near_first ? d_left : d_right;
+    }
+
+    // Heap-sort in place so the nearest object comes first
+    for(int n = count - 1; n > 0; n--) {
+        float td = heap[0];
+        heap[0] = heap[n];
+        heap[n] = td;
+        int ti = dest[0];
+        dest[0] = dest[n];
+        dest[n] = ti;
+        _pl_bvh_heap_sift_down_internal(heap, dest, n, 0);
+    }
+
+    if(dest_dist) {
+        for(int i = 0; i < count; i++) dest_dist[i] = sqrtf(dest_dist[i]);
+    }
+    else free(heap);
+
+    return count;
+}
+
+// Reports every pair of objects from 'bvh_a' and 'bvh_b' whose AABBs overlap
+// as two ints in 'dest' ('dest_sz' counts pairs). Passing the same tree twice
+// finds each self-overlapping pair once, lower object index first. Returns the
+// total number of pairs, or -1 when out of memory.
+int pl_bvh_query_pairs(pl_bvh_t *bvh_a, pl_bvh_t *bvh_b, int *dest, size_t dest_sz) {
+    if(!bvh_a || !bvh_b || !dest || bvh_a->node_count == 0 || bvh_b->node_count == 0) return 0;
+
+    int self = (bvh_a == bvh_b);
+    int pair_count = 0;
+    int stack_capacity = PL_BVH_STACK_SIZE * 2;
+    int *stack = malloc(sizeof(int) * 2 * stack_capacity);
+    if(!stack) return -1;
+    int stack_ptr = 0;
+
+    stack[0] = 0;
+    stack[1] = 0;
+    stack_ptr = 1;
+
+    while(stack_ptr > 0) {
+        --stack_ptr;
+        int ia = stack[2 * stack_ptr];
+        int ib = stack[2 * stack_ptr + 1];
+        pl_bvh_node_t *a = &bvh_a->nodes[ia];
+        pl_bvh_node_t *b = &bvh_b->nodes[ib];
+
+        if(stack_ptr + 3 > stack_capacity) {
+            int *new_stack = realloc(stack, sizeof(int) * 4 * stack_capacity);
+            if(!new_stack) {
+                free(stack);
+                return -1;
+            }
+            stack = new_stack;
+            stack_capacity *= 2;
+        }
+
+        if(self && ia == ib) {
+            // Pairs inside one subtree: both halves on their own, then across
+            if(a->left == PL_BVH_LEAFNODE) continue;
+            int children[3][2] = {
+                {a->left, a->left},
+                {a->right, a->right},
+                {a->left, a->right}
+            };
+            for(int c = 0; c < 3; c++) {
+                stack[2 * stack_ptr] = children[c][0];
+                stack[2 * stack_ptr + 1] = children[c][1];
+                stack_ptr++;
+            }
+            continue;
+        }
+
+        if(!_pl_bvh_aabb_overlap_internal(&a->aabb, &b->aabb)) continue;
+
+        int leaf_a = (a->left == PL_BVH_LEAFNODE);
+        int leaf_b = (b->left == PL_BVH_LEAFNODE);
+        if(leaf_a && leaf_b) {
+            if((size_t)pair_count < dest_sz) {
+                int first = a->obj_idx;
+                int second = b->obj_idx;
+                if(self && first > second) {
+                    first = b->obj_idx;
+                    second = a->obj_idx;
+                }
+                dest[2 * pair_count] = first;
+                dest[2 * pair_count + 1] = second;
+            }
+            pair_count++;
+            continue;
+        }
+
+        // Descend into the larger of the two nodes
+        int split_a = !leaf_a && (leaf_b ||
+            _pl_bvh_area_internal(a->aabb.min, a->aabb.max) >= _pl_bvh_area_internal(b->aabb.min, b->aabb.max));
+        if(split_a) {
+            stack[2 * stack_ptr] = a->left;
+            stack[2 * stack_ptr + 1] = ib;
+            stack_ptr++;
+            stack[2 * stack_ptr] = a->right;
+            stack[2 * stack_ptr + 1] = ib;
+            stack_ptr++;
+        }
+        else {
+            stack[2 * stack_ptr] = ia;
+            stack[2 * stack_ptr + 1] = b->left;
+            stack_ptr++;
+            stack[2 * stack_ptr] = ia;
+            stack[2 * stack_ptr + 1] = b->right;
+            stack_ptr++;
+        }
+    }
+
+    free(stack);
+    return pair_count;
+}
+
+// Origins and reciprocal directions of up to PL_BVH_PACKET_SIZE rays, one array per axis
+typedef struct _pl_bvh_packet_s {
+    float origin[3][PL_BVH_PACKET_SIZE];
+    float inv_dir[3][PL_BVH_PACKET_SIZE];
+    float padding[3];
+} _pl_bvh_packet_t;
+
+static inline unsigned int _pl_bvh_packet_test_internal(
+    const _pl_bvh_packet_t *packet,
+    const pl_bvh_aabb_t *aabb,
+    float ray_range
+) {
+#if defined(PL_BVH_AVX)
+    __m256 tmin = _mm256_setzero_ps();
+    __m256 tmax = _mm256_set1_ps(ray_range);
+    for(int a = 0; a < 3; a++) {
+        __m256 inv = _mm256_loadu_ps(packet->inv_dir[a]);
+        __m256 origin = _mm256_loadu_ps(packet->origin[a]);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabb->min[a] - packet->padding[a]), origin), inv);
+        __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(aabb->max[a] + packet->padding[a]), origin), inv);
+        tmin = _mm256_max_ps(tmin, _mm256_min_ps(t1, t2));
+        tmax = _mm256_min_ps(tmax, _mm256_max_ps(t1, t2));
+    }
+    return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+#elif defined(PL_BVH_SSE)
+    __m128 tmin = _mm_setzero_ps();
+    __m128 tmax = _mm_set1_ps(ray_range);
+    for(int a = 0; a < 3; a++) {
+        __m128 inv = _mm_loadu_ps(packet->inv_dir[a]);
+        __m128 origin = _mm_loadu_ps(packet->origin[a]);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb->min[a] - packet->padding[a]), origin), inv);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb->max[a] + packet->padding[a]), origin), inv);
+        tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+        tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+    }
+    return (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax));
+#else
+    unsigned int mask = 0;
+    for(int r = 0; r < PL_BVH_PACKET_SIZE; r++) {
+        float tmin = 0.0f;
+        float tmax = ray_range;
+        for(int a = 0; a < 3; a++) {
+            float t1 = ((aabb->min[a] - packet->padding[a]) - packet->origin[a][r]) * packet->inv_dir[a][r];
+            float t2 = ((aabb->max[a] + packet->padding[a]) - packet->origin[a][r]) * packet->inv_dir[a][r];
+            if(t1 > t2) {
+                float temp = t1;
+                t1 = t2;
+                t2 = temp;
+            }
+            if(t1 > tmin) tmin = t1;
+            if(t2 < tmax) tmax = t2;
+        }
+        if(tmin <= tmax) mask |= 1u << r;
+    }
+    return mask;
+#endif
+}
+
+static int _pl_bvh_push_hit_internal(int **hits, int *count, int *capacity, int obj_idx) {
+    if(*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        int *new_hits = realloc(*hits, sizeof(int) * new_capacity);
+        if(!new_hits) return 1;
+        *hits = new_hits;
+        *capacity = new_capacity;
+    }
+    (*hits)[(*count)++] = obj_idx;
+    return 0;
+}
+
+// Traverses the rays in groups of PL_BVH_PACKET_SIZE, so neighbouring rays
+// in the input should be coherent. Hits of ray i are written to
+// dest[offsets[i] .. offsets[i + 1]) as long as they fit in dest_sz;
+// offsets needs ray_count + 1 entries. Returns the total hit count, or -1
+// when out of memory.
+int pl_bvh_ray_intersection_batch(
+    pl_bvh_t *bvh,
+    float (*ray_origins)[3],
+    float (*ray_dirs)[3],
+    size_t ray_count,
+    float ray_range,
+    float padding[3],
+    int *offsets,
+    int *dest,
+    size_t dest_sz
+) {
+    if(!bvh || !ray_origins || !ray_dirs || !offsets) return 0;
+
+    int *lane_hits[PL_BVH_PACKET_SIZE] = {0};
+    int lane_count[PL_BVH_PACKET_SIZE];
+    int lane_capacity[PL_BVH_PACKET_SIZE] = {0};
+    int total = 0;
+    int failed = 0;
+
+    for(size_t base = 0; base < ray_count && !failed; base += PL_BVH_PACKET_SIZE) {
+        size_t packet_rays = ray_count - base < PL_BVH_PACKET_SIZE ? ray_count - base : PL_BVH_PACKET_SIZE;
+        _pl_bvh_packet_t packet;
+        packet.padding[0] = padding[0];
+        packet.padding[1] = padding[1];
+        packet.padding[2] = padding[2];
+
+        for(int r = 0; r < PL_BVH_PACKET_SIZE; r++) {
+            size_t ray = base + ((size_t)r < packet_rays ? (size_t)r : 0);
+            for(int a = 0; a < 3; a++) {
+                float dir = ray_dirs[ray][a];
+                packet.inv_dir[a][r] = (dir == 0.0f) ? copysignf(FLT_MAX, 1.0f) : 1.0f / dir;
+                packet.origin[a][r] = ray_origins[ray][a];
+            }
+            lane_count[r] = 0;
+        }
+
+        unsigned int stack_mask[PL_BVH_STACK_SIZE];
+        int stack[PL_BVH_STACK_SIZE];
+        int stack_ptr = 0;
+
+        if(bvh->node_count > 0) {
+            stack[stack_ptr] = 0;
+            stack_mask[stack_ptr++] = (1u << packet_rays) - 1;
+        }
+
+        // A lane stays active only while every ancestor was hit, which keeps
+        // per-ray results identical to pl_bvh_ray_intersection
+        while(stack_ptr > 0 && !failed) {
+            --stack_ptr;
+            pl_bvh_node_t *node = &bvh->nodes[stack[stack_ptr]];
+            unsigned int mask = stack_mask[stack_ptr] & _pl_bvh_packet_test_internal(&packet, &node->aabb, ray_range);
+            if(!mask) continue;
+
+            if(node->left == PL_BVH_LEAFNODE) {
+                for(int r = 0; mask; r++, mask >>= 1) {
+                    if(!(mask & 1u)) continue;
+                    if(_pl_bvh_push_hit_internal(&lane_hits[r], &lane_count[r], &lane_capacity[r], node->obj_idx) != 0) {
+                        failed = 1;
+                        break;
+                    }
+                }
+            }
+            else if(stack_ptr + 2 <= PL_BVH_STACK_SIZE) {
+                stack[stack_ptr] = node->left;
+                stack_mask[stack_ptr++] = mask;
+                stack[stack_ptr] = node->right;
+                stack_mask[stack_ptr++] = mask;
+            }
+        }
+
+        for(size_t r = 0; r < packet_rays; r++) {
+            offsets[base + r] = total;
+            for(int h = 0; h < lane_count[r]; h++) {
+                if((size_t)total < dest_sz) dest[total] = lane_hits[r][h];
+                total++;
+            }
+        }
+    }
+
+    offsets[ray_count] = total;
+    for(int r = 0; r < PL_BVH_PACKET_SIZE; r++) free(lane_hits[r]);
+    return failed ? -1 : total;
+}
+
+static void *_pl_bvh_aligned_alloc_internal(size_t size, size_t alignment) {
+    size = (size + alignment - 1) & ~(alignment - 1);
+#if defined(_WIN32)
+    return _aligned_malloc(size, alignment);
+#else
+    return aligned_alloc(alignment, size);
+#endif
+}
+
+static void _pl_bvh_aligned_free_internal(void *ptr) {
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+static inline void _pl_bvh_wide_set_lane_internal(
+    float *soa,
+    int stride,
+    int lane,
+    const pl_bvh_aabb_t *aabb
+) {
+    soa[0 * stride + lane] = aabb->min[0];
+    soa[1 * stride + lane] = aabb->min[1];
+    soa[2 * stride + lane] = aabb->min[2];
+    soa[3 * stride + lane] = aabb->max[0];
+    soa[4 * stride + lane] = aabb->max[1];
+    soa[5 * stride + lane] = aabb->max[2];
+}
+
+int pl_bvh_wide_init(pl_bvh_wide_t *wide, pl_bvh_t *bvh, int width) {
+    if(!wide || !bvh || (width != 4 && width != 8)) return 1;
+
+    wide->nodes = NULL;
+    wide->node_count = 0;
+    wide->width = width;
+    if(bvh->node_count == 0) return 0;
+
+    // A wide node always replaces at least one binary internal node
+    int capacity = bvh->node_count / 2 + 1;
+    size_t node_sz = (width == 4) ? sizeof(pl_bvh4_node_t) : sizeof(pl_bvh8_node_t);
+    size_t align = (width == 4) ? 16 : 32;
+    int *sources = malloc(sizeof(int) * capacity);
+    wide->nodes = _pl_bvh_aligned_alloc_internal(node_sz * capacity, align);
+    if(!sources || !wide->nodes) {
+        free(sources);
+        pl_bvh_wide_free(wide);
+        return 1;
+    }
+
+    pl_bvh_node_t *nodes = bvh->nodes;
+    sources[0] = 0;
+    wide->node_count = 1;
+
+    // Breadth-first: each wide node pulls up the largest internal children of
+    // its binary source until it has 'width' children
+    for(int w = 0; w < wide->node_count; w++) {
+        int children[8];
+        int child_count = 0;
+        pl_bvh_node_t *src = &nodes[sources[w]];
+
+        if(src->left == PL_BVH_LEAFNODE) children[child_count++] = sources[w];
+        else {
+            children[child_count++] = src->left;
+            children[child_count++] = src->right;
+        }
+
+        while(child_count < width) {
+            int best = -1;
+            float best_area = -1.0f;
+            for(int c = 0; c < child_count; c++) {
+                pl_bvh_node_t *child = &nodes[children[c]];
+                if(child->left == PL_BVH_LEAFNODE) continue;
+                float area = _pl_bvh_area_internal(child->aabb.min, child->aabb.max);
+                if(area > best_area) {
+                    best_area = area;
+                    best = c;
+                }
+            }
+            if(best < 0) break;
+
+            pl_bvh_node_t *expand = &nodes[children[best]];
+            children[best] = expand->left;
+            children[child_count++] = expand->right;
+        }
+
+        float *soa;
+        int *child_out;
+        if(width == 4) {
+            pl_bvh4_node_t *out = &((pl_bvh4_node_t*)wide->nodes)[w];
+            soa = out->min_x;
+            child_out = out->child;
+        }
+        else {
+            pl_bvh8_node_t *out = &((pl_bvh8_node_t*)wide->nodes)[w];
+            soa = out->min_x;
+            child_out = out->child;
+        }
+
+        for(int c = 0; c < width; c++) {
+            if(c >= child_count) {
+                pl_bvh_aabb_t empty;
+                _pl_bvh_aabb_reset_internal(&empty);
+                _pl_bvh_wide_set_lane_internal(soa, width, c, &empty);
+                child_out[c] = PL_BVH_WIDE_EMPTY;
+                continue;
+            }
+
+            pl_bvh_node_t *child = &nodes[children[c]];
+            _pl_bvh_wide_set_lane_internal(soa, width, c, &child->aabb);
+            if(child->left == PL_BVH_LEAFNODE) child_out[c] = PL_BVH_WIDE_LEAF(child->obj_idx);
+            else {
+                sources[wide->node_count] = children[c];
+                child_out[c] = wide->node_count++;
+            }
+        }
+    }
+
+    free(sources);
+    return 0;
+}
+
+void pl_bvh_wide_free(pl_bvh_wide_t *wide) {
+    if(!wide) return;
+    if(wide->nodes) _pl_bvh_aligned_free_internal(wide->nodes);
+    wide->nodes = NULL;
+    wide->node_count = 0;
+}
+
+// Returns a bitmask of the children of 'soa' whose padded bounds the ray hits
+static inline unsigned int _pl_bvh_wide_test_internal(
+    const float *soa,
+    int width,
+    const float origin[3],
+    const float padding[3],
+    const float inv_dir[3],
+    float ray_range
+) {
+#if defined(PL_BVH_AVX)
+    if(width == 8) {
+        __m256 tmin = _mm256_setzero_ps();
+        __m256 tmax = _mm256_set1_ps(ray_range);
+        for(int a = 0; a < 3; a++) {
+            __m256 inv = _mm256_set1_ps(inv_dir[a]);
+            __m256 o = _mm256_set1_ps(origin[a]);
+            __m256 pad = _mm256_set1_ps(padding[a]);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_load_ps(soa + a * 8), pad), o), inv);
+            __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(_mm256_load_ps(soa + (a + 3) * 8), pad), o), inv);
+            tmin = _mm256_max_ps(tmin, _mm256_min_ps(t1, t2));
+            tmax = _mm256_min_ps(tmax, _mm256_max_ps(t1, t2));
+        }
+        return (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+    }
+#endif
+#if defined(PL_BVH_SSE)
+    unsigned int mask = 0;
+    for(int base = 0; base < width; base += 4) {
+        __m128 tmin = _mm_setzero_ps();
+        __m128 tmax = _mm_set1_ps(ray_range);
+        for(int a = 0; a < 3; a++) {
+            __m128 inv = _mm_set1_ps(inv_dir[a]);
+            __m128 o = _mm_set1_ps(origin[a]);
+            __m128 pad = _mm_set1_ps(padding[a]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_load_ps(soa + a * width + base), pad), o), inv);
+            __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_add_ps(_mm_load_ps(soa + (a + 3) * width + base), pad), o), inv);
+            tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+            tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+        }
+        mask |= (unsigned int)_mm_movemask_ps(_mm_cmple_ps(tmin, tmax)) << base;
+    }
+    return mask;
+#else
+    unsigned int mask = 0;
+    for(int c = 0; c < width; c++) {
+        float tmin = 0.0f;
+        float tmax = ray_range;
+        for(int a = 0; a < 3; a++) {
+            float t1 = ((soa[a * width + c] - padding[a]) - origin[a]) * inv_dir[a];
+            float t2 = ((soa[(a + 3) * width + c] + padding[a]) - origin[a]) * inv_dir[a];
+            if(t1 > t2) {
+                float temp = t1;
+                t1 = t2;
+                t2 = temp;
+            }
+            if(t1 > tmin) tmin = t1;
+            if(t2 < tmax) tmax = t2;
+        }
+        if(tmin <= tmax) mask |= 1u << c;
+    }
+    return mask;
+#endif
+}
+
+int pl_bvh_wide_ray_intersection(
+    pl_bvh_wide_t *wide,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+) {
+    if(!wide || !dest || wide->node_count == 0) return 0;
+
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
+    int width = wide->width;
+    int hit_count = 0;
+    int stack[PL_BVH_WIDE_STACK_SIZE];
+    int stack_ptr = 0;
+
+    stack[stack_ptr++] = 0;
+
+    while(stack_ptr > 0) {
+        int node_idx = stack[--stack_ptr];
+        const float *soa;
+        const int *child;
+        if(width == 4) {
+            pl_bvh4_node_t *node = &((pl_bvh4_node_t*)wide->nodes)[node_idx];
+            soa = node->min_x;
+            child = node->child;
+        }
+        else {
+            pl_bvh8_node_t *node = &((pl_bvh8_node_t*)wide->nodes)[node_idx];
+            soa = node->min_x;
+            child = node->child;
+        }
+
+        unsigned int mask = _pl_bvh_wide_test_internal(soa, width, ray_origin, padding, inv_dir, ray_range);
+        for(int c = 0; mask; c++, mask >>= 1) {
+            if(!(mask & 1u) || child[c] == PL_BVH_WIDE_EMPTY) continue;
+            if(child[c] < 0) {
+                if((size_t)hit_count < dest_sz) dest[hit_count] = PL_BVH_WIDE_OBJIDX(child[c]);
+                hit_count++;
+            }
+            else if(stack_ptr < PL_BVH_WIDE_STACK_SIZE) stack[stack_ptr++] = child[c];
+        }
+    }
+
+    return hit_count;
+}
+
+typedef struct _pl_bvh_compact_build_s {
+    pl_bvh_compact_node_t *nodes;
+    _pl_bvh_indexed_aabb_t *items;
+    int node_count;
+    int max_leaf_size;
+} _pl_bvh_compact_build_t;
+
+static void _pl_bvh_compact_build_internal(_pl_bvh_compact_build_t *build, int start, int end, int depth) {
+    _pl_bvh_indexed_aabb_t *items = build->items;
+    pl_bvh_compact_node_t *node = &build->nodes[build->node_count++];
+    int count = end - start;
+
+    pl_bvh_aabb_t bounds;
+    _pl_bvh_aabb_reset_internal(&bounds);
+    for(int i = start; i < end; i++) _pl_bvh_aabb_grow_internal(&bounds, &items[i].aabb);
+    memcpy(node->min, bounds.min, sizeof(node->min));
+    memcpy(node->max, bounds.max, sizeof(node->max));
+
+    // Stop at a leaf once it is small enough and testing every primitive costs
+    // no more than a traversal step (relative to one primitive test) plus the best split
+    int mid = -1;
+    if(count > 1 && depth < PL_BVH_SAH_MAX_DEPTH) {
+        float split_cost = FLT_MAX;
+        mid = _pl_bvh_sah_split_internal(items, start, end, &split_cost);
+        float area = _pl_bvh_area_internal(bounds.min, bounds.max);
+        if(count <= build->max_leaf_size && area * (float)count <= PL_BVH_COMPACT_TRAVERSAL_COST * area + split_cost) mid = -1;
+    }
+    if(mid < 0 && count <= build->max_leaf_size) {
+        node->offset = start;
+        node->count = count;
+        return;
+    }
+    if(mid < 0) {
+        float extent[3] = {
+            bounds.max[0] - bounds.min[0],
+            bounds.max[1] - bounds.min[1],
+            bounds.max[2] - bounds.min[2]
+        };
+        int axis = (extent[0] > extent[1] && extent[0] > extent[2]) ? 0 : (extent[1] > extent[2] ? 1 : 2);
+        mid = start + count / 2;
+        _pl_bvh_nth_element_internal(items, start, end, mid, axis);
+    }
+
+    node->count = 0;
+    _pl_bvh_compact_build_internal(build, start, mid, depth + 1);
+    node->offset = build->node_count;
+    _pl_bvh_compact_build_internal(build, mid, end, depth + 1);
+}
+
+// Builds a compact BVH whose leaves hold up to 'max_leaf_size' primitives
+// (clamped to [1, PL_BVH_COMPACT_MAX_LEAF_SIZE]). Returns 0 on success.
+int pl_bvh_compact_init(pl_bvh_compact_t *compact, pl_bvh_aabb_t *aabbs, size_t aabb_count, int max_leaf_size) {
+    if(!compact) return 1;
+
+    compact->nodes = NULL;
+    compact->prim_indices = NULL;
+    compact->node_count = 0;
+    compact->prim_count = 0;
+    if(aabb_count == 0) return 0;
+    if(!aabbs) return 1;
+
+    if(max_leaf_size < 1) max_leaf_size = 1;
+    if(max_leaf_size > PL_BVH_COMPACT_MAX_LEAF_SIZE) max_leaf_size = PL_BVH_COMPACT_MAX_LEAF_SIZE;
+
+    _pl_bvh_indexed_aabb_t *items = malloc(sizeof(_pl_bvh_indexed_aabb_t) * aabb_count);
+    pl_bvh_compact_node_t *scratch = malloc(sizeof(pl_bvh_compact_node_t) * (2 * aabb_count - 1));
+    int *prim_indices = malloc(sizeof(int) * aabb_count);
+    if(!items || !scratch || !prim_indices) {
+        free(items);
+        free(scratch);
+        free(prim_indices);
+        return 1;
+    }
+    for(size_t i = 0; i < aabb_count; i++) {
+        items[i].idx = (int)i;
+        items[i].aabb = aabbs[i];
+    }
+
+    _pl_bvh_compact_build_t build = {scratch, items, 0, max_leaf_size};
+    _pl_bvh_compact_build_internal(&build, 0, (int)aabb_count, 0);
+    for(size_t i = 0; i < aabb_count; i++) prim_indices[i] = items[i].idx;
+    free(items);
+
+    // Copy into an exactly sized, 32-byte aligned allocation
+    compact->nodes = _pl_bvh_aligned_alloc_internal(sizeof(pl_bvh_compact_node_t) * build.node_count, 32);
+    if(!compact->nodes) {
+        free(scratch);
+        free(prim_indices);
+        return 1;
+    }
+    memcpy(compact->nodes, scratch, sizeof(pl_bvh_compact_node_t) * build.node_count);
+    free(scratch);
+
+    compact->prim_indices = prim_indices;
+    compact->node_count = build.node_count;
+    compact->prim_count = (int)aabb_count;
+    return 0;
+}
+
+void pl_bvh_compact_free(pl_bvh_compact_t *compact) {
+    if(!compact) return;
+    if(compact->nodes) _pl_bvh_aligned_free_internal(compact->nodes);
+    free(compact->prim_indices);
+    compact->nodes = NULL;
+    compact->prim_indices = NULL;
+    compact->node_count = 0;
+    compact->prim_count = 0;
+}
+
+// Reports every primitive of each leaf the ray hits, so the result is a
+// superset of the per-object hits of pl_bvh_ray_intersection
+int pl_bvh_compact_ray_intersection(
+    pl_bvh_compact_t *compact,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+) {
+    if(!compact || !dest || compact->node_count == 0) return 0;
+
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
+    int hit_count = 0;
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+    int node_idx = 0;
+
+    for(;;) {
+        pl_bvh_compact_node_t *node = &compact->nodes[node_idx];
+
+        if(_pl_bvh_ray_aabb_intersection_internal(
+            ray_origin, inv_dir, ray_range,
+            node->min, node->max, padding, NULL)) {
+            if(node->count > 0) {
+                for(int i = 0; i < node->count; i++) {
+                    if((size_t)hit_count < dest_sz) dest[hit_count] = compact->prim_indices[node->offset + i];
+                    hit_count++;
+                }
+            }
+            else {
+                // Go straight on to the left child, which is the next node
+                if(stack_ptr < PL_BVH_STACK_SIZE) stack[stack_ptr++] = node->offset;
+                node_idx++;
+                continue;
+            }
+        }
+
+        if(stack_ptr == 0) break;
+        node_idx = stack[--stack_ptr];
+    }
+
+    return hit_count;
+}
+
+// Builds a quantized copy of 'compact', which can be freed afterwards
+int pl_bvh_quantized_init(pl_bvh_quantized_t *quantized, pl_bvh_compact_t *compact) {
+    if(!quantized || !compact) return 1;
+
+    quantized->nodes = NULL;
+    quantized->prim_indices = NULL;
+    quantized->node_count = 0;
+    quantized->prim_count = 0;
+    if(compact->node_count == 0) return 0;
+    if((size_t)compact->prim_count >= ((size_t)1 << 27)) return 1;
+
+    quantized->nodes = _pl_bvh_aligned_alloc_internal(sizeof(pl_bvh_qnode_t) * compact->node_count, 32);
+    quantized->prim_indices = malloc(sizeof(int) * compact->prim_count);
+    if(!quantized->nodes || !quantized->prim_indices) {
+        pl_bvh_quantized_free(quantized);
+        return 1;
+    }
+    memcpy(quantized->prim_indices, compact->prim_indices, sizeof(int) * compact->prim_count);
+
+    // Grow the step until the top grid value covers the scene bounds in float math
+    pl_bvh_compact_node_t *root = &compact->nodes[0];
+    for(int a = 0; a < 3; a++) {
+        float origin = root->min[a];
+        float scale = (root->max[a] - origin) / (float)PL_BVH_QUANTIZED_MAX;
+        while(origin + (float)PL_BVH_QUANTIZED_MAX * scale < root->max[a]) scale = nextafterf(scale, FLT_MAX);
+        quantized->origin[a] = origin;
+        quantized->scale[a] = scale;
+    }
+
+    for(int n = 0; n < compact->node_count; n++) {
+        pl_bvh_compact_node_t *src = &compact->nodes[n];
+        pl_bvh_qnode_t *dst = &quantized->nodes[n];
+
+        for(int a = 0; a < 3; a++) {
+            float origin = quantized->origin[a];
+            float scale = quantized->scale[a];
+            long lo = 0;
+            long hi = 0;
+            if(scale > 0.0f) {
+                lo = (long)floorf((src->min[a] - origin) / scale);
+                hi = (long)ceilf((src->max[a] - origin) / scale);
+            }
+            if(lo < 0) lo = 0;
+            if(hi > PL_BVH_QUANTIZED_MAX) hi = PL_BVH_QUANTIZED_MAX;
+
+            // Round outwards so the decoded box always contains the original
+            while(lo > 0 && origin + (float)lo * scale > src->min[a]) lo--;
+            while(hi < PL_BVH_QUANTIZED_MAX && origin + (float)hi * scale < src->max[a]) hi++;
+            dst->min[a] = (uint16_t)lo;
+            dst->max[a] = (uint16_t)hi;
+        }
+
+        if(src->count > 0) dst->data = 0x80000000u | ((uint32_t)src->offset << 4) | (uint32_t)(src->count - 1);
+        else dst->data = (uint32_t)src->offset;
+    }
+
+    quantized->node_count = compact->node_count;
+    quantized->prim_count = compact->prim_count;
+    return 0;
+}
+
+void pl_bvh_quantized_free(pl_bvh_quantized_t *quantized) {
+    if(!quantized) return;
+    if(quantized->nodes) _pl_bvh_aligned_free_internal(quantized->nodes);
+    free(quantized->prim_indices);
+    quantized->nodes = NULL;
+    quantized->prim_indices = NULL;
+    quantized->node_count = 0;
+    quantized->prim_count = 0;
+}
+
+// Same hits as pl_bvh_compact_ray_intersection on the source tree, plus
+// whatever the slightly larger quantized bounds let through
+int pl_bvh_quantized_ray_intersection(
+    pl_bvh_quantized_t *quantized,
+    float ray_origin[3],
+    float ray_dir[3],
+    float ray_range,
+    float padding[3],
+    int *dest,
+    size_t dest_sz
+) {
+    if(!quantized || !dest || quantized->node_count == 0) return 0;
+
+    float inv_dir[3];
+    _pl_bvh_inv_dir_internal(ray_dir, inv_dir);
+
+    int hit_count = 0;
+    int stack[PL_BVH_STACK_SIZE];
+    int stack_ptr = 0;
+    int node_idx = 0;
+
+    for(;;) {
+        pl_bvh_qnode_t *node = &quantized->nodes[node_idx];
+        float min[3], max[3];
+        for(int a = 0; a < 3; a++) {
+            min[a] = quantized->origin[a] + (float)node->min[a] * quantized->scale[a];
+            max[a] = quantized->origin[a] + (float)node->max[a] * quantized->scale[a];
+        }
+
+        if(_pl_bvh_ray_aabb_intersection_internal(
+            ray_origin, inv_dir, ray_range,
+            min, max, padding, NULL)) {
+            if(node->data & 0x80000000u) {
+                int first = (int)((node->data & 0x7fffffffu) >> 4);
+                int count = (int)(node->data & 0xfu) + 1;
+                for(int i = 0; i < count; i++) {
+                    if((size_t)hit_count < dest_sz) dest[hit_count] = quantized->prim_indices[first + i];
+                    hit_count++;
+                }
+            }
+            else {
+                if(stack_ptr < PL_BVH_STACK_SIZE) stack[stack_ptr++] = (int)node->data;
+                node_idx++;
+                continue;
+            }
+        }
+
+        if(stack_ptr == 0) break;
+        node_idx = stack[--stack_ptr];
+    }
+
+    return hit_count;
+}
+
+// On-disk header; the node array follows at offset 64 in native layout
+typedef struct _pl_bvh_file_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t node_size;
+    uint32_t node_count;
+    uint64_t source_checksum;
+    uint64_t node_checksum;
+    uint8_t reserved[24];
+} _pl_bvh_file_header_t;
+
+#define _PL_BVH_FILE_MAGIC  "PLATOBVH"
+#define _PL_BVH_FILE_ENDIAN 0x01020304u
+
+// FNV-1a; pass the source AABBs to get a 'source_checksum' for pl_bvh_save
+uint64_t pl_bvh_checksum(const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Writes the nodes with a header recording the format version, byte order,
+// node size and the caller's 'source_checksum'. Returns 0 on success.
+int pl_bvh_save(pl_bvh_t *bvh, const char *path, uint64_t source_checksum) {
+    if(!bvh || !path || (bvh->node_count > 0 && !bvh->nodes)) return 1;
+
+    _pl_bvh_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, _PL_BVH_FILE_MAGIC, sizeof(header.magic));
+    header.version = PL_BVH_FILE_VERSION;
+    header.endian = _PL_BVH_FILE_ENDIAN;
+    header.node_size = (uint32_t)sizeof(pl_bvh_node_t);
+    header.node_count = (uint32_t)bvh->node_count;
+    header.source_checksum = source_checksum;
+    header.node_checksum = pl_bvh_checksum(bvh->nodes, sizeof(pl_bvh_node_t) * bvh->node_count);
+
+    FILE *file = fopen(path, "wb");
+    if(!file) return 1;
+
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    if(!failed && bvh->node_count > 0) {
+        failed = fwrite(bvh->nodes, sizeof(pl_bvh_node_t), (size_t)bvh->node_count, file) != (size_t)bvh->node_count;
+    }
+    if(fclose(file) != 0) failed = 1;
+    return failed;
+}
+
+// Maps a file written by pl_bvh_save and points bvh->nodes straight at it.
+// Pages are copy-on-write, so refitting a loaded tree never touches the file.
+// Fails if the header does not match this build or 'source_checksum'; with
+// PL_BVH_LOAD_VERIFY the node checksum is checked too, which reads every page.
+int pl_bvh_load_mmap(
+    pl_bvh_t *bvh,
+    pl_bvh_mapping_t *mapping,
+    const char *path,
+    uint64_t source_checksum,
+    int flags
+) {
+    if(!bvh || !mapping || !path) return 1;
+
+    memset(mapping, 0, sizeof(*mapping));
+    bvh->nodes = NULL;
+    bvh->node_count = 0;
+
+#if defined(_WIN32)
+    mapping->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(mapping->file == INVALID_HANDLE_VALUE) {
+        mapping->file = NULL;
+        return 1;
+    }
+    LARGE_INTEGER file_size;
+    if(!GetFileSizeEx(mapping->file, &file_size) || (uint64_t)file_size.QuadPart < sizeof(_pl_bvh_file_header_t)) {
+        pl_bvh_unload(mapping);
+        return 1;
+    }
+    mapping->size = (size_t)file_size.QuadPart;
+    mapping->map = CreateFileMappingA(mapping->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if(mapping->map) mapping->base = MapViewOfFile(mapping->map, FILE_MAP_COPY, 0, 0, 0);
+    if(!mapping->base) {
+        pl_bvh_unload(mapping);
+        return 1;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 1;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(_pl_bvh_file_header_t)) {
+        close(fd);
+        return 1;
+    }
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return 1;
+    mapping->base = base;
+    mapping->size = (size_t)st.st_size;
+#endif
+
+    const _pl_bvh_file_header_t *header = (const _pl_bvh_file_header_t*)mapping->base;
+    int valid = memcmp(header->magic, _PL_BVH_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+                header->version == PL_BVH_FILE_VERSION &&
+                header->endian == _PL_BVH_FILE_ENDIAN &&
+                header->node_size == sizeof(pl_bvh_node_t) &&
+                header->node_count <= (uint32_t)INT32_MAX &&
+                header->source_checksum == source_checksum &&
+                mapping->size - sizeof(_pl_bvh_file_header_t) >= (size_t)header->node_count * sizeof(pl_bvh_node_t);
+
+    pl_bvh_node_t *nodes = (pl_bvh_node_t*)((char*)mapping->base + sizeof(_pl_bvh_file_header_t));
+    if(valid && (flags & PL_BVH_LOAD_VERIFY)) {
+        valid = pl_bvh_checksum(nodes, sizeof(pl_bvh_node_t) * header->node_count) == header->node_checksum;
+    }
+    if(!valid) {
+        pl_bvh_unload(mapping);
+        return 1;
+    }
+
+    bvh->nodes = nodes;
+    bvh->node_count = (int)header->node_count;
+    return 0;
+}
+
+void pl_bvh_unload(pl_bvh_mapping_t *mapping) {
+    if(!mapping) return;
+
+#if defined(_WIN32)
+    if(mapping->base) UnmapViewOfFile(mapping->base);
+    if(mapping->map) CloseHandle(mapping->map);
+    if(mapping->file) CloseHandle(mapping->file);
+    mapping->map = NULL;
+    mapping->file = NULL;
+#else
+    if(mapping->base) munmap(mapping->base, mapping->size);
+#endif
+    mapping->base = NULL;
+    mapping->size = 0;
+}
 
 #endif // PLATO_BVH_IMPLEMENTATION
 #endif // PLATO_BVH_H
\ No newline at end of file
@@ -2,18 +2,40 @@
 #define PLATO_HASHMAP_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include "plato_arena.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PL_HASHMAP_SSE
+#endif
+
+#define PL_HASHMAP_GROUP_WIDTH 16
+#define _PL_HASHMAP_EMPTY 0x80
+
+// The full hash and key length are kept next to the key so that probes and
+// resizes never need to touch (or re-hash) the key itself
 typedef struct pl_hashmap_entry_s {
     const char *key;
     void *value;
+    uint64_t hash;
+    size_t len;
 } pl_hashmap_entry_t;
 
+// Open addressing with a separate control byte per slot: 0x80 for an empty
+// slot, otherwise the low 7 bits of the key's hash. Probing is linear by
+// slot, scanning PL_HASHMAP_GROUP_WIDTH control bytes at a time. 'ctrl' has
+// PL_HASHMAP_GROUP_WIDTH extra bytes mirroring the first ones so a group can
+// be loaded at any slot without wrapping. Keys are copied into 'arena' when
+// one is given, otherwise each key gets its own malloc.
 typedef struct pl_hashmap_s {
     pl_hashmap_entry_t* entries;
+    uint8_t *ctrl;
     size_t capacity;
     size_t length;
+    pl_arena_t *arena;
 } pl_hashmap_t;
 
 typedef struct pl_hashmap_iter_s{
@@ -24,27 +46,330 @@ typedef struct pl_hashmap_iter_s{
 } pl_hashmap_iter_t;
 
 pl_hashmap_t *pl_hashmap_init(void);
+pl_hashmap_t *pl_hashmap_init_arena(pl_arena_t *arena);
 void pl_hashmap_destroy(pl_hashmap_t* hm);
 void* pl_hashmap_get(pl_hashmap_t* hm, const char* key);
+void* pl_hashmap_get_n(pl_hashmap_t* hm, const char* key, size_t len);
 const char* pl_hashmap_set(pl_hashmap_t* hm, const char* key, void* value);
+const char* pl_hashmap_set_n(pl_hashmap_t* hm, const char* key, size_t len, void* value);
+int pl_hashmap_remove(pl_hashmap_t* hm, const char* key);
+int pl_hashmap_remove_n(pl_hashmap_t* hm, const char* key, size_t len);
+int pl_hashmap_reserve(pl_hashmap_t* hm, size_t count);
 size_t pl_hashmap_len(pl_hashmap_t* hm);
 pl_hashmap_iter_t pl_hashmap_iter(pl_hashmap_t* hm);
 int pl_hashmap_next(pl_hashmap_iter_t* iter);
 
+#define PL_CHASHMAP_SHARD_BITS 6
+#define PL_CHASHMAP_SHARD_COUNT (1 << PL_CHASHMAP_SHARD_BITS)
+#define PL_CHASHMAP_MIGRATE_STEP 64
+
+typedef struct _pl_chashmap_slot_s {
+    _Atomic(const char*) key;
+    _Atomic(void*) value;
+    uint64_t hash;
+    size_t len;
+} _pl_chashmap_slot_t;
+
+// Linear-probing table that never drops keys, a removed key keeps its slot
+// with a NULL value. While a resize is in progress 'prev' points at the table
+// being migrated; it is moved to the shard's 'retired' list once empty.
+typedef struct _pl_chashmap_table_s {
+    _Atomic(struct _pl_chashmap_table_s*) prev;
+    struct _pl_chashmap_table_s *retired;
+    size_t capacity;
+    size_t used;
+    _pl_chashmap_slot_t slots[];
+} _pl_chashmap_table_t;
+
+typedef struct _pl_chashmap_shard_s {
+    _Atomic(_pl_chashmap_table_t*) table;
+    atomic_size_t length;
+    pl_mtx_t lock;
+    pl_arena_t *arena;
+    _pl_chashmap_table_t *retired;
+    size_t migrate_pos;
+    char _pad[64];
+} _pl_chashmap_shard_t;
+
+// Concurrent string-keyed map. Keys pick one of PL_CHASHMAP_SHARD_COUNT
+// shards by the top bits of their hash; writers take that shard's lock,
+// readers take no lock at all and finish in a bounded number of steps. A
+// shard grows by publishing a table twice the size and letting each later
+// write to the shard migrate PL_CHASHMAP_MIGRATE_STEP slots of the old one,
+// with readers loading the old table pointer first, then probing the new table
+// and falling back to the old one. Keys are interned in a per-shard arena.
+// Since readers never announce themselves, removed keys and replaced tables
+// stay allocated until pl_chashmap_reclaim is called at a point where no other
+// thread is using the map; callers that remove keys should do so periodically
+// to keep memory bounded.
+typedef struct pl_chashmap_s {
+    _pl_chashmap_shard_t shards[PL_CHASHMAP_SHARD_COUNT];
+} pl_chashmap_t;
+
+pl_chashmap_t *pl_chashmap_init(void);
+void pl_chashmap_destroy(pl_chashmap_t *map);
+void *pl_chashmap_get(pl_chashmap_t *map, const char *key);
+void *pl_chashmap_get_n(pl_chashmap_t *map, const char *key, size_t len);
+int pl_chashmap_set(pl_chashmap_t *map, const char *key, void *value);
+int pl_chashmap_set_n(pl_chashmap_t *map, const char *key, size_t len, void *value);
+int pl_chashmap_remove(pl_chashmap_t *map, const char *key);
+int pl_chashmap_remove_n(pl_chashmap_t *map, const char *key, size_t len);
+int pl_chashmap_reclaim(pl_chashmap_t *map);
+size_t pl_chashmap_len(pl_chashmap_t *map);
+
+static inline int _pl_hashmap_ctz_internal(uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(v);
+#else
+    int n = 0;
+    while(!(v & 1u)) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Bitmask of the slots in the group at 'group' whose control byte equals 'h2'
+static inline uint32_t _pl_hashmap_match_internal(const uint8_t *group, uint8_t h2) {
+#if defined(PL_HASHMAP_SSE)
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < PL_HASHMAP_GROUP_WIDTH; i++) {
+        if(group[i] == h2) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint32_t _pl_hashmap_match_empty_internal(const uint8_t *group) {
+#if defined(PL_HASHMAP_SSE)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    uint32_t mask = 0;
+    for(int i = 0; i < PL_HASHMAP_GROUP_WIDTH; i++) {
+        if(group[i] & _PL_HASHMAP_EMPTY) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+static inline uint64_t pl_hash_u64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint64_t pl_hash_u32(uint32_t x) {
+    uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 32);
+}
+
+static inline int pl_hash_eq_u32(uint32_t a, uint32_t b) { return a == b; }
+static inline int pl_hash_eq_u64(uint64_t a, uint64_t b) { return a == b; }
+
+// Generates a map type 'name_t' with keys and values stored inline in the
+// same control-byte layout as pl_hashmap_t. 'hash' maps a K to a uint64_t and
+// 'eq' returns non-zero for equal keys; any V is allowed, including zero.
+//
+//   PL_HASHMAP_DEFINE(entity_map, uint32_t, float, pl_hash_u32, pl_hash_eq_u32)
+//
+// defines entity_map_init/destroy/get/set/remove/reserve/len/next. get returns
+// a pointer to the stored value (NULL when absent), set/remove/reserve return
+// 0 on success and next walks the entries from *index = 0 until it returns 1.
+#define PL_HASHMAP_DEFINE(name, K, V, hash, eq) \
+    typedef struct name##_entry_s { \
+        K key; \
+        V value; \
+    } name##_entry_t; \
+    \
+    typedef struct name##_s { \
+        name##_entry_t *entries; \
+        uint8_t *ctrl; \
+        size_t capacity; \
+        size_t length; \
+    } name##_t; \
+    \
+    static inline int name##_alloc_internal(name##_t *hm, size_t capacity) { \
+        name##_entry_t *entries = (name##_entry_t*)malloc(capacity * sizeof(name##_entry_t)); \
+        uint8_t *ctrl = (uint8_t*)malloc(capacity + PL_HASHMAP_GROUP_WIDTH); \
+        if(!entries || !ctrl) { \
+            free(entries); \
+            free(ctrl); \
+            return 1; \
+        } \
+        memset(ctrl, _PL_HASHMAP_EMPTY, capacity + PL_HASHMAP_GROUP_WIDTH); \
+        hm->entries = entries; \
+        hm->ctrl = ctrl; \
+        hm->capacity = capacity; \
+        return 0; \
+    } \
+    \
+    static inline name##_t *name##_init(void) { \
+        name##_t *hm = (name##_t*)malloc(sizeof(name##_t)); \
+        if(!hm) return NULL; \
+        hm->length = 0; \
+        if(name##_alloc_internal(hm, PL_HASHMAP_GROUP_WIDTH) != 0) { \
+            free(hm); \
+            return NULL; \
+        } \
+        return hm; \
+    } \
+    \
+    static inline void name##_destroy(name##_t *hm) { \
+        if(!hm) return; \
+        free(hm->entries); \
+        free(hm->ctrl); \
+        free(hm); \
+    } \
+    \
+    static inline void name##_set_ctrl_internal(name##_t *hm, size_t index, uint8_t value) { \
+        hm->ctrl[index] = value; \
+        if(index < PL_HASHMAP_GROUP_WIDTH) hm->ctrl[hm->capacity + index] = value; \
+    } \
+    \
+    static inline ptrdiff_t name##_find_internal(name##_t *hm, K key, uint64_t h, size_t *insert_index) { \
+        size_t mask = hm->capacity - 1; \
+        size_t pos = (size_t)(h >> 7) & mask; \
+        uint8_t h2 = (uint8_t)(h & 0x7f); \
+        for(;;) { \
+            const uint8_t *group = hm->ctrl + pos; \
+            uint32_t match = _pl_hashmap_match_internal(group, h2); \
+            while(match) { \
+                size_t index = (pos + _pl_hashmap_ctz_internal(match)) & mask; \
+                if(eq(hm->entries[index].key, key)) return (ptrdiff_t)index; \
+                match &= match - 1; \
+            } \
+            uint32_t empty = _pl_hashmap_match_empty_internal(group); \
+            if(empty) { \
+                if(insert_index) *insert_index = (pos + _pl_hashmap_ctz_internal(empty)) & mask; \
+                return -1; \
+            } \
+            pos = (pos + PL_HASHMAP_GROUP_WIDTH) & mask; \
+        } \
+    } \
+    \
+    static inline int name##_rehash_internal(name##_t *hm, size_t new_capacity) { \
+        name##_t old = *hm; \
+        if(name##_alloc_internal(hm, new_capacity) != 0) return 1; \
+        for(size_t i = 0; i < old.capacity; i++) { \
+            if(old.ctrl[i] & _PL_HASHMAP_EMPTY) continue; \
+            uint64_t h = hash(old.entries[i].key); \
+            size_t index = 0; \
+            name##_find_internal(hm, old.entries[i].key, h, &index); \
+            name##_set_ctrl_internal(hm, index, (uint8_t)(h & 0x7f)); \
+            hm->entries[index] = old.entries[i]; \
+        } \
+        free(old.entries); \
+        free(old.ctrl); \
+        return 0; \
+    } \
+    \
+    static inline int name##_reserve(name##_t *hm, size_t count) { \
+        size_t capacity = hm->capacity; \
+        while(count > capacity - capacity / 8) { \
+            if(capacity * 2 < capacity) return 1; \
+            capacity *= 2; \
+        } \
+        if(capacity == hm->capacity) return 0; \
+        return name##_rehash_internal(hm, capacity); \
+    } \
+    \
+    static inline V *name##_get(name##_t *hm, K key) { \
+        ptrdiff_t index = name##_find_internal(hm, key, hash(key), NULL); \
+        return index < 0 ? NULL : &hm->entries[index].value; \
+    } \
+    \
+    static inline int name##_set(name##_t *hm, K key, V value) { \
+        uint64_t h = hash(key); \
+        size_t index = 0; \
+        ptrdiff_t found = name##_find_internal(hm, key, h, &index); \
+        if(found >= 0) { \
+            hm->entries[found].value = value; \
+            return 0; \
+        } \
+        if(hm->length + 1 > hm->capacity - hm->capacity / 8) { \
+            if(name##_rehash_internal(hm, hm->capacity * 2) != 0) return 1; \
+            name##_find_internal(hm, key, h, &index); \
+        } \
+        name##_set_ctrl_internal(hm, index, (uint8_t)(h & 0x7f)); \
+        hm->entries[index].key = key; \
+        hm->entries[index].value = value; \
+        hm->length++; \
+        return 0; \
+    } \
+    \
+    static inline int name##_remove(name##_t *hm, K key) { \
+        ptrdiff_t found = name##_find_internal(hm, key, hash(key), NULL); \
+        if(found < 0) return 1; \
+        size_t hole = (size_t)found; \
+        size_t mask = hm->capacity - 1; \
+        for(size_t i = (hole + 1) & mask; !(hm->ctrl[i] & _PL_HASHMAP_EMPTY); i = (i + 1) & mask) { \
+            size_t home = (size_t)(hash(hm->entries[i].key) >> 7) & mask; \
+            if(((i - home) & mask) >= ((i - hole) & mask)) { \
+                hm->entries[hole] = hm->entries[i]; \
+                name##_set_ctrl_internal(hm, hole, hm->ctrl[i]); \
+                hole = i; \
+            } \
+        } \
+        name##_set_ctrl_internal(hm, hole, _PL_HASHMAP_EMPTY); \
+        hm->length--; \
+        return 0; \
+    } \
+    \
+    static inline size_t name##_len(name##_t *hm) { \
+        return hm->length; \
+    } \
+    \
+    static inline int name##_next(name##_t *hm, size_t *index, K *key, V *value) { \
+        while(*index < hm->capacity) { \
+            size_t i = (*index)++; \
+            if(hm->ctrl[i] & _PL_HASHMAP_EMPTY) continue; \
+            if(key) *key = hm->entries[i].key; \
+            if(value) *value = hm->entries[i].value; \
+            return 0; \
+        } \
+        return 1; \
+    }
+
 #if defined(PLATO_IMPLEMENTATION) || defined(PLATO_HASHMAP_IMPLEMENTATION)
 
 #define _PL_HASHMAP_INITIAL_CAPACITY 16
-#define _FNV_OFFSET 14695981039346656037UL
-#define _FNV_PRIME 1099511628211UL
+
+static int _pl_hashmap_alloc_internal(pl_hashmap_t *hm, size_t capacity) {
+    pl_hashmap_entry_t *entries = (pl_hashmap_entry_t*)malloc(capacity * sizeof(pl_hashmap_entry_t));
+    uint8_t *ctrl = (uint8_t*)malloc(capacity + PL_HASHMAP_GROUP_WIDTH);
+    if(!entries || !ctrl) {
+        free(entries);
+        free(ctrl);
+        return 1;
+    }
+    memset(ctrl, _PL_HASHMAP_EMPTY, capacity + PL_HASHMAP_GROUP_WIDTH);
+
+    hm->entries = entries;
+    hm->ctrl = ctrl;
+    hm->capacity = capacity;
+    return 0;
+}
 
 pl_hashmap_t *pl_hashmap_init(void) {
+    return pl_hashmap_init_arena(NULL);
+}
+
+// Keys are interned in 'arena', which must outlive the map; destroying the
+// map then leaves the keys to be released with the arena in one go
+pl_hashmap_t *pl_hashmap_init_arena(pl_arena_t *arena) {
     pl_hashmap_t *hm = (pl_hashmap_t*)malloc(sizeof(pl_hashmap_t));
     if(!hm) return NULL;
     hm->length = 0;
-    hm->capacity = _PL_HASHMAP_INITIAL_CAPACITY;
+    hm->arena = arena;
 
-    hm->entries = (pl_hashmap_entry_t*)calloc(hm->capacity, sizeof(pl_hashmap_entry_t));
-    if(!hm->entries) {
+    if(_pl_hashmap_alloc_internal(hm, _PL_HASHMAP_INITIAL_CAPACITY) != 0) {
         free(hm);
         return NULL;
     }
@@ -52,88 +377,249 @@ pl_hashmap_t *pl_hashmap_init(void) {
 }
 
 void pl_hashmap_destroy(pl_hashmap_t *hm) {
-    for (size_t i = 0; i < hm->capacity; i++) free((void*)hm->entries[i].key);
+    for (size_t i = 0; !hm->arena && i < hm->capacity; i++) {
+        if(!(hm->ctrl[i] & _PL_HASHMAP_EMPTY)) free((void*)hm->entries[i].key);
+    }
     free(hm->entries);
+    free(hm->ctrl);
     free(hm);
 }
 
-static uint64_t _pl_hash_key_internal(const char *key) {
-    uint64_t hash = _FNV_OFFSET;
-    for(const char* p = key; *p; p++) {
-        hash ^= (uint64_t)(unsigned char)(*p);
-        hash *= _FNV_PRIME;
-    }
-    return hash;
+// 64x64 -> 128-bit multiply, returning the low half in 'a' and the high half in 'b'
+static inline void _pl_hash_mum_internal(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
 }
 
-void* pl_hashmap_get(pl_hashmap_t *hm, const char *key) {
-    uint64_t hash = _pl_hash_key_internal(key);
-    size_t index = (size_t)(hash & (uint64_t)(hm->capacity - 1));
+static inline uint64_t _pl_hash_mix_internal(uint64_t a, uint64_t b) {
+    _pl_hash_mum_internal(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t _pl_hash_read8_internal(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
 
-    while(hm->entries[index].key != NULL) {
-        if(strcmp(key, hm->entries[index].key) == 0) return hm->entries[index].value;
-        index++;
-        if(index >= hm->capacity) index = 0;
+static inline uint64_t _pl_hash_read4_internal(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// wyhash (final version 4): reads the key 8 or 16 bytes at a time and mixes
+// with 128-bit multiplies
+static uint64_t _pl_hash_key_internal(const void *key, size_t len) {
+    static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+        0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+    };
+    const uint8_t *p = (const uint8_t*)key;
+    uint64_t seed = _pl_hash_mix_internal(secret[0], secret[1]);
+    uint64_t a, b;
+
+    if(len <= 16) {
+        if(len >= 4) {
+            a = (_pl_hash_read4_internal(p) << 32) | _pl_hash_read4_internal(p + ((len >> 3) << 2));
+            b = (_pl_hash_read4_internal(p + len - 4) << 32) | _pl_hash_read4_internal(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if(len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else a = b = 0;
     }
-    return NULL;
+    else {
+        size_t i = len;
+        if(i >= 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = _pl_hash_mix_internal(_pl_hash_read8_internal(p) ^ secret[1], _pl_hash_read8_internal(p + 8) ^ seed);
+                see1 = _pl_hash_mix_internal(_pl_hash_read8_internal(p + 16) ^ secret[2], _pl_hash_read8_internal(p + 24) ^ see1);
+                see2 = _pl_hash_mix_internal(_pl_hash_read8_internal(p + 32) ^ secret[3], _pl_hash_read8_internal(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16) {
+            seed = _pl_hash_mix_internal(_pl_hash_read8_internal(p) ^ secret[1], _pl_hash_read8_internal(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = _pl_hash_read8_internal(p + i - 16);
+        b = _pl_hash_read8_internal(p + i - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    _pl_hash_mum_internal(&a, &b);
+    return _pl_hash_mix_internal(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+static inline void _pl_hashmap_set_ctrl_internal(pl_hashmap_t *hm, size_t index, uint8_t value) {
+    hm->ctrl[index] = value;
+    if(index < PL_HASHMAP_GROUP_WIDTH) hm->ctrl[hm->capacity + index] = value;
 }
 
-static const char* _pl_hashmap_set_entry_internal(
-    pl_hashmap_entry_t *entries, 
-    size_t capacity,
-    const char *key, 
-    void* value, 
-    size_t *plength
+// Returns the slot holding 'key', or -1 with the first free slot on its probe
+// path in 'insert_index'
+static inline ptrdiff_t _pl_hashmap_find_internal(
+    pl_hashmap_t *hm,
+    const char *key,
+    size_t len,
+    uint64_t hash,
+    size_t *insert_index
 ) {
-    uint64_t hash = _pl_hash_key_internal(key);
-    size_t index = (size_t)(hash & (uint64_t)(capacity - 1));
+    size_t mask = hm->capacity - 1;
+    size_t pos = (size_t)(hash >> 7) & mask;
+    uint8_t h2 = (uint8_t)(hash & 0x7f);
 
-    while(entries[index].key != NULL) {
-        if(strcmp(key, entries[index].key) == 0) {
-            entries[index].value = value;
-            return entries[index].key;
+    for(;;) {
+        const uint8_t *group = hm->ctrl + pos;
+        uint32_t match = _pl_hashmap_match_internal(group, h2);
+        while(match) {
+            size_t index = (pos + _pl_hashmap_ctz_internal(match)) & mask;
+            pl_hashmap_entry_t *entry = &hm->entries[index];
+            if(entry->hash == hash && entry->len == len && memcmp(key, entry->key, len) == 0) return (ptrdiff_t)index;
+            match &= match - 1;
         }
-        index++;
-        if(index >= capacity) index = 0;
+
+        uint32_t empty = _pl_hashmap_match_empty_internal(group);
+        if(empty) {
+            if(insert_index) *insert_index = (pos + _pl_hashmap_ctz_internal(empty)) & mask;
+            return -1;
+        }
+        pos = (pos + PL_HASHMAP_GROUP_WIDTH) & mask;
     }
+}
+
+void* pl_hashmap_get(pl_hashmap_t *hm, const char *key) {
+    return pl_hashmap_get_n(hm, key, strlen(key));
+}
+
+// Looks up the first 'len' bytes of 'key', which need not be NUL-terminated
+void* pl_hashmap_get_n(pl_hashmap_t *hm, const char *key, size_t len) {
+    ptrdiff_t index = _pl_hashmap_find_internal(hm, key, len, _pl_hash_key_internal(key, len), NULL);
+    return index < 0 ? NULL : hm->entries[index].value;
+}
 
-    if(plength != NULL) {
-        key = strdup(key);
-        if(key == NULL) return NULL;
-        (*plength)++;
+static int _pl_hashmap_rehash_internal(pl_hashmap_t *hm, size_t new_capacity) {
+    pl_hashmap_t old = *hm;
+    if(_pl_hashmap_alloc_internal(hm, new_capacity) != 0) return 1;
+
+    // Keys are unique and their hashes are stored, so each entry goes
+    // straight into the first free slot on its probe path
+    size_t mask = new_capacity - 1;
+    for(size_t i = 0; i < old.capacity; i++) {
+        if(old.ctrl[i] & _PL_HASHMAP_EMPTY) continue;
+        uint64_t hash = old.entries[i].hash;
+        size_t pos = (size_t)(hash >> 7) & mask;
+        uint32_t empty;
+        while(!(empty = _pl_hashmap_match_empty_internal(hm->ctrl + pos))) pos = (pos + PL_HASHMAP_GROUP_WIDTH) & mask;
+        size_t index = (pos + _pl_hashmap_ctz_internal(empty)) & mask;
+        _pl_hashmap_set_ctrl_internal(hm, index, (uint8_t)(hash & 0x7f));
+        hm->entries[index] = old.entries[i];
     }
-    entries[index].key = (char*)key;
-    entries[index].value = value;
-    return key;
+
+    free(old.entries);
+    free(old.ctrl);
+    return 0;
 }
 
 static int _pl_hashmap_expand_internal(pl_hashmap_t *hm) {
     size_t new_capacity = hm->capacity * 2;
     if(new_capacity < hm->capacity) return 1;
-    pl_hashmap_entry_t *new_entries = (pl_hashmap_entry_t*)calloc(new_capacity, sizeof(pl_hashmap_entry_t));
-    if(new_entries == NULL) return 1;
+    return _pl_hashmap_rehash_internal(hm, new_capacity);
+}
 
-    for(size_t i = 0; i < hm->capacity; i++) {
-        pl_hashmap_entry_t entry = hm->entries[i];
-        if(entry.key != NULL) {
-            _pl_hashmap_set_entry_internal(new_entries, new_capacity, entry.key, entry.value, NULL);
-        }
+// Grows the table once so that 'count' keys fit without further resizing
+int pl_hashmap_reserve(pl_hashmap_t *hm, size_t count) {
+    size_t capacity = hm->capacity;
+    while(count > capacity - capacity / 8) {
+        if(capacity * 2 < capacity) return 1;
+        capacity *= 2;
     }
-
-    free(hm->entries);
-    hm->entries = new_entries;
-    hm->capacity = new_capacity;
-    return 0;
+    if(capacity == hm->capacity) return 0;
+    return _pl_hashmap_rehash_internal(hm, capacity);
 }
 
 const char* pl_hashmap_set(pl_hashmap_t *hm, const char *key, void *value) {
+    return pl_hashmap_set_n(hm, key, strlen(key), value);
+}
+
+// Stores a NUL-terminated copy of the first 'len' bytes of 'key'
+const char* pl_hashmap_set_n(pl_hashmap_t *hm, const char *key, size_t len, void *value) {
     if(value == NULL) return NULL;
 
-    if(hm->length >= hm->capacity / 2) {
+    uint64_t hash = _pl_hash_key_internal(key, len);
+    size_t index = 0;
+    ptrdiff_t found = _pl_hashmap_find_internal(hm, key, len, hash, &index);
+    if(found >= 0) {
+        hm->entries[found].value = value;
+        return hm->entries[found].key;
+    }
+
+    // Grow past 7/8 full; the free slot has to be found again afterwards
+    if(hm->length + 1 > hm->capacity - hm->capacity / 8) {
         if(_pl_hashmap_expand_internal(hm) != 0) return NULL;
+        _pl_hashmap_find_internal(hm, key, len, hash, &index);
     }
 
-    return _pl_hashmap_set_entry_internal(hm->entries, hm->capacity, key, value, &hm->length);
+    char *copy = hm->arena ? (char*)pl_arena_alloc_uninit(hm->arena, len + 1) : (char*)malloc(len + 1);
+    if(copy == NULL) return NULL;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+
+    _pl_hashmap_set_ctrl_internal(hm, index, (uint8_t)(hash & 0x7f));
+    hm->entries[index].key = copy;
+    hm->entries[index].value = value;
+    hm->entries[index].hash = hash;
+    hm->entries[index].len = len;
+    hm->length++;
+    return copy;
+}
+
+int pl_hashmap_remove(pl_hashmap_t *hm, const char *key) {
+    return pl_hashmap_remove_n(hm, key, strlen(key));
+}
+
+// Backward-shift deletion: later entries of the probe run move up into the
+// hole so that no tombstones are needed. Returns 1 if 'key' was not found.
+int pl_hashmap_remove_n(pl_hashmap_t *hm, const char *key, size_t len) {
+    ptrdiff_t found = _pl_hashmap_find_internal(hm, key, len, _pl_hash_key_internal(key, len), NULL);
+    if(found < 0) return 1;
+
+    size_t hole = (size_t)found;
+    if(!hm->arena) free((void*)hm->entries[hole].key);
+
+    size_t mask = hm->capacity - 1;
+    for(size_t i = (hole + 1) & mask; !(hm->ctrl[i] & _PL_HASHMAP_EMPTY); i = (i + 1) & mask) {
+        // An entry may fill the hole only if the hole lies between its home slot and itself
+        size_t home = (size_t)(hm->entries[i].hash >> 7) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            hm->entries[hole] = hm->entries[i];
+            _pl_hashmap_set_ctrl_internal(hm, hole, hm->ctrl[i]);
+            hole = i;
+        }
+    }
+
+    _pl_hashmap_set_ctrl_internal(hm, hole, _PL_HASHMAP_EMPTY);
+    hm->length--;
+    return 0;
 }
 
 size_t pl_hashmap_len(pl_hashmap_t *hm) {
@@ -152,7 +638,7 @@ int pl_hashmap_next(pl_hashmap_iter_t *iter) {
     while(iter->_index < hm->capacity) {
         size_t i = iter->_index;
         iter->_index++;
-        if(hm->entries[i].key != NULL) {
+        if(!(hm->ctrl[i] & _PL_HASHMAP_EMPTY)) {
             pl_hashmap_entry_t entry = hm->entries[i];
             iter->key = entry.key;
             iter->value = entry.value;
@@ -162,5 +648,352 @@ int pl_hashmap_next(pl_hashmap_iter_t *iter) {
     return 1;
 }
 
+#define _PL_CHASHMAP_INITIAL_CAPACITY 16
+#define _PL_CHASHMAP_ARENA_BLOCK 4096
+
+static _pl_chashmap_table_t *_pl_chashmap_table_alloc_internal(size_t capacity) {
+    _pl_chashmap_table_t *table = (_pl_chashmap_table_t*)malloc(sizeof(_pl_chashmap_table_t) + capacity * sizeof(_pl_chashmap_slot_t));
+    if(!table) return NULL;
+    atomic_init(&table->prev, NULL);
+    table->retired = NULL;
+    table->capacity = capacity;
+    table->used = 0;
+    for(size_t i = 0; i < capacity; i++) {
+        atomic_init(&table->slots[i].key, NULL);
+        atomic_init(&table->slots[i].value, NULL);
+    }
+    return table;
+}
+
+// Tables are kept at most 3/4 full, so the probe always ends at an empty slot.
+// The key pointer is published last, which makes 'hash' and 'len' safe to read
+// once it has been seen.
+static _pl_chashmap_slot_t *_pl_chashmap_find_internal(_pl_chashmap_table_t *table, const char *key, size_t len, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = (size_t)hash & mask;
+    for(;;) {
+        _pl_chashmap_slot_t *slot = &table->slots[i];
+        const char *k = atomic_load_explicit(&slot->key, memory_order_acquire);
+        if(!k) return NULL;
+        if(slot->hash == hash && slot->len == len && memcmp(k, key, len) == 0) return slot;
+        i = (i + 1) & mask;
+    }
+}
+
+// Only called with the shard lock held and 'key' absent from 'table'
+static void _pl_chashmap_insert_internal(_pl_chashmap_table_t *table, const char *key, size_t len, uint64_t hash, void *value) {
+    size_t mask = table->capacity - 1;
+    size_t i = (size_t)hash & mask;
+    while(atomic_load_explicit(&table->slots[i].key, memory_order_relaxed)) i = (i + 1) & mask;
+
+    _pl_chashmap_slot_t *slot = &table->slots[i];
+    slot->hash = hash;
+    slot->len = len;
+    atomic_store_explicit(&slot->value, value, memory_order_relaxed);
+    atomic_store_explicit(&slot->key, key, memory_order_release);
+    table->used++;
+}
+
+// Copies the next 'steps' slots of the table being migrated into 'table'.
+// Removed keys are dropped; keys already in 'table' were written after the
+// resize started and win over the old copy.
+static void _pl_chashmap_migrate_internal(_pl_chashmap_shard_t *shard, _pl_chashmap_table_t *table, size_t steps) {
+    _pl_chashmap_table_t *prev = atomic_load_explicit(&table->prev, memory_order_relaxed);
+    if(!prev) return;
+
+    size_t end = shard->migrate_pos + (steps < prev->capacity ? steps : prev->capacity);
+    if(end > prev->capacity) end = prev->capacity;
+    for(size_t i = shard->migrate_pos; i < end; i++) {
+        _pl_chashmap_slot_t *slot = &prev->slots[i];
+        const char *key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+        void *value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+        if(!key || !value) continue;
+        if(!_pl_chashmap_find_internal(table, key, slot->len, slot->hash)) {
+            _pl_chashmap_insert_internal(table, key, slot->len, slot->hash, value);
+        }
+    }
+    shard->migrate_pos = end;
+
+    if(end == prev->capacity) {
+        atomic_store_explicit(&table->prev, NULL, memory_order_release);
+        prev->retired = shard->retired;
+        shard->retired = prev;
+        shard->migrate_pos = 0;
+    }
+}
+
+// Makes room for one more key, starting a resize if the table is 3/4 full.
+// The previous migration is always done by then: a table of capacity C is
+// replaced by one of 2C holding at most 3C/4 live keys, or by one of C holding
+// at most C/2, so at least C/4 inserts happen before the next resize while
+// every write copies PL_CHASHMAP_MIGRATE_STEP slots and needs only C/64 writes
+// to empty the old table. The call below only guards that invariant and never
+// finds slots left to copy, so no write pays for a full rehash.
+static _pl_chashmap_table_t *_pl_chashmap_grow_internal(_pl_chashmap_shard_t *shard) {
+    _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    if(table->used + 1 <= table->capacity - table->capacity / 4) return table;
+
+    _pl_chashmap_migrate_internal(shard, table, SIZE_MAX);
+
+    // Only grow when live keys fill half the table; otherwise the new table
+    // just sheds the removed ones
+    size_t length = atomic_load_explicit(&shard->length, memory_order_relaxed);
+    size_t capacity = (length + 1) * 2 > table->capacity ? table->capacity * 2 : table->capacity;
+    _pl_chashmap_table_t *next = _pl_chashmap_table_alloc_internal(capacity);
+    if(!next) return NULL;
+    atomic_store_explicit(&next->prev, table, memory_order_relaxed);
+    shard->migrate_pos = 0;
+    atomic_store_explicit(&shard->table, next, memory_order_release);
+    return next;
+}
+
+static void _pl_chashmap_free_retired_internal(_pl_chashmap_shard_t *shard) {
+    while(shard->retired) {
+        _pl_chashmap_table_t *retired = shard->retired;
+        shard->retired = retired->retired;
+        free(retired);
+    }
+}
+
+// Rebuilds a shard into a table sized for its live keys and a fresh arena
+// holding only their names. Leaves the shard untouched on allocation failure.
+static int _pl_chashmap_compact_internal(_pl_chashmap_shard_t *shard) {
+    _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    size_t length = atomic_load_explicit(&shard->length, memory_order_relaxed);
+
+    size_t capacity = _PL_CHASHMAP_INITIAL_CAPACITY;
+    while(capacity / 2 < length) capacity *= 2;
+    _pl_chashmap_table_t *next = _pl_chashmap_table_alloc_internal(capacity);
+    if(!next) return 1;
+
+    pl_arena_t *arena = NULL;
+    if(length) {
+        arena = pl_arena_init_chained(_PL_CHASHMAP_ARENA_BLOCK);
+        if(!arena) {
+            free(next);
+            return 1;
+        }
+    }
+
+    for(size_t i = 0; i < table->capacity; i++) {
+        _pl_chashmap_slot_t *slot = &table->slots[i];
+        const char *key = atomic_load_explicit(&slot->key, memory_order_relaxed);
+        void *value = atomic_load_explicit(&slot->value, memory_order_relaxed);
+        if(!key || !value) continue;
+
+        char *copy = (char*)pl_arena_alloc_uninit(arena, slot->len + 1);
+        if(!copy) {
+            pl_arena_free(arena);
+            free(next);
+            return 1;
+        }
+        memcpy(copy, key, slot->len + 1);
+        _pl_chashmap_insert_internal(next, copy, slot->len, slot->hash, value);
+    }
+
+    free(table);
+    pl_arena_free(shard->arena);
+    shard->arena = arena;
+    atomic_store_explicit(&shard->table, next, memory_order_relaxed);
+    return 0;
+}
+
+pl_chashmap_t *pl_chashmap_init(void) {
+    pl_chashmap_t *map = (pl_chashmap_t*)malloc(sizeof(pl_chashmap_t));
+    if(!map) return NULL;
+
+    int s = 0;
+    for(; s < PL_CHASHMAP_SHARD_COUNT; s++) {
+        _pl_chashmap_shard_t *shard = &map->shards[s];
+        _pl_chashmap_table_t *table = _pl_chashmap_table_alloc_internal(_PL_CHASHMAP_INITIAL_CAPACITY);
+        if(!table) break;
+        if(pl_mtx_init(&shard->lock, PL_MTX_PLAIN) != PL_THREAD_SUCCESS) {
+            free(table);
+            break;
+        }
+        atomic_init(&shard->table, table);
+        atomic_init(&shard->length, 0);
+        shard->arena = NULL;
+        shard->retired = NULL;
+        shard->migrate_pos = 0;
+    }
+    if(s < PL_CHASHMAP_SHARD_COUNT) {
+        while(s-- > 0) {
+            pl_mtx_destroy(&map->shards[s].lock);
+            free(atomic_load_explicit(&map->shards[s].table, memory_order_relaxed));
+        }
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+// No other thread may be using the map
+void pl_chashmap_destroy(pl_chashmap_t *map) {
+    if(!map) return;
+
+    for(int s = 0; s < PL_CHASHMAP_SHARD_COUNT; s++) {
+        _pl_chashmap_shard_t *shard = &map->shards[s];
+        _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        free(atomic_load_explicit(&table->prev, memory_order_relaxed));
+        free(table);
+        _pl_chashmap_free_retired_internal(shard);
+        pl_arena_free(shard->arena);
+        pl_mtx_destroy(&shard->lock);
+    }
+    free(map);
+}
+
+void *pl_chashmap_get(pl_chashmap_t *map, const char *key) {
+    if(!key) return NULL;
+    return pl_chashmap_get_n(map, key, strlen(key));
+}
+
+// Wait-free: two bounded probes and no stores. 'prev' must be loaded before
+// 'table' is probed; loaded after a miss, the migration may have copied the
+// key and cleared 'prev' in between, losing a key that was always present.
+// The old table is not freed before pl_chashmap_reclaim, so it stays valid.
+void *pl_chashmap_get_n(pl_chashmap_t *map, const char *key, size_t len) {
+    if(!map || !key) return NULL;
+
+    uint64_t hash = _pl_hash_key_internal(key, len);
+    _pl_chashmap_shard_t *shard = &map->shards[hash >> (64 - PL_CHASHMAP_SHARD_BITS)];
+    _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    _pl_chashmap_table_t *prev = atomic_load_explicit(&table->prev, memory_order_acquire);
+
+    _pl_chashmap_slot_t *slot = _pl_chashmap_find_internal(table, key, len, hash);
+    if(!slot && prev) slot = _pl_chashmap_find_internal(prev, key, len, hash);
+    return slot ? atomic_load_explicit(&slot->value, memory_order_acquire) : NULL;
+}
+
+int pl_chashmap_set(pl_chashmap_t *map, const char *key, void *value) {
+    if(!key) return 1;
+    return pl_chashmap_set_n(map, key, strlen(key), value);
+}
+
+// Returns 0 on success, 1 on a NULL value or allocation failure
+int pl_chashmap_set_n(pl_chashmap_t *map, const char *key, size_t len, void *value) {
+    if(!map || !key || !value) return 1;
+
+    uint64_t hash = _pl_hash_key_internal(key, len);
+    _pl_chashmap_shard_t *shard = &map->shards[hash >> (64 - PL_CHASHMAP_SHARD_BITS)];
+    pl_mtx_lock(&shard->lock);
+
+    _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    _pl_chashmap_migrate_internal(shard, table, PL_CHASHMAP_MIGRATE_STEP);
+
+    const char *interned = NULL;
+    _pl_chashmap_slot_t *slot = _pl_chashmap_find_internal(table, key, len, hash);
+    if(!slot) {
+        _pl_chashmap_table_t *prev = atomic_load_explicit(&table->prev, memory_order_relaxed);
+        if(prev) slot = _pl_chashmap_find_internal(prev, key, len, hash);
+
+        // A removed key behind the migration cursor will not be copied again,
+        // so it is re-inserted instead of revived in place
+        if(slot && !atomic_load_explicit(&slot->value, memory_order_relaxed)) {
+            interned = atomic_load_explicit(&slot->key, memory_order_relaxed);
+            slot = NULL;
+        }
+    }
+
+    if(slot) {
+        if(!atomic_load_explicit(&slot->value, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&shard->length, 1, memory_order_relaxed);
+        }
+        atomic_store_explicit(&slot->value, value, memory_order_release);
+        pl_mtx_unlock(&shard->lock);
+        return 0;
+    }
+
+    if(!interned) {
+        if(!shard->arena) shard->arena = pl_arena_init_chained(_PL_CHASHMAP_ARENA_BLOCK);
+        char *copy = shard->arena ? (char*)pl_arena_alloc_uninit(shard->arena, len + 1) : NULL;
+        if(!copy) {
+            pl_mtx_unlock(&shard->lock);
+            return 1;
+        }
+        memcpy(copy, key, len);
+        copy[len] = '\0';
+        interned = copy;
+    }
+
+    table = _pl_chashmap_grow_internal(shard);
+    if(!table) {
+        pl_mtx_unlock(&shard->lock);
+        return 1;
+    }
+    _pl_chashmap_insert_internal(table, interned, len, hash, value);
+    atomic_fetch_add_explicit(&shard->length, 1, memory_order_relaxed);
+    pl_mtx_unlock(&shard->lock);
+    return 0;
+}
+
+int pl_chashmap_remove(pl_chashmap_t *map, const char *key) {
+    if(!key) return 1;
+    return pl_chashmap_remove_n(map, key, strlen(key));
+}
+
+// Returns 1 if the key was not found
+int pl_chashmap_remove_n(pl_chashmap_t *map, const char *key, size_t len) {
+    if(!map || !key) return 1;
+
+    uint64_t hash = _pl_hash_key_internal(key, len);
+    _pl_chashmap_shard_t *shard = &map->shards[hash >> (64 - PL_CHASHMAP_SHARD_BITS)];
+    pl_mtx_lock(&shard->lock);
+
+    _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    _pl_chashmap_migrate_internal(shard, table, PL_CHASHMAP_MIGRATE_STEP);
+
+    _pl_chashmap_slot_t *slot = _pl_chashmap_find_internal(table, key, len, hash);
+    if(!slot) {
+        _pl_chashmap_table_t *prev = atomic_load_explicit(&table->prev, memory_order_relaxed);
+        if(prev) slot = _pl_chashmap_find_internal(prev, key, len, hash);
+    }
+
+    int result = 1;
+    if(slot && atomic_load_explicit(&slot->value, memory_order_relaxed)) {
+        atomic_store_explicit(&slot->value, NULL, memory_order_release);
+        atomic_fetch_sub_explicit(&shard->length, 1, memory_order_relaxed);
+        result = 0;
+    }
+    pl_mtx_unlock(&shard->lock);
+    return result;
+}
+
+// Releases the storage of removed keys and replaced tables. No other thread
+// may be using the map. Shards without removed keys are left alone; returns 1
+// if a shard could not be rebuilt, which keeps it usable as it was.
+int pl_chashmap_reclaim(pl_chashmap_t *map) {
+    if(!map) return 1;
+
+    int result = 0;
+    for(int s = 0; s < PL_CHASHMAP_SHARD_COUNT; s++) {
+        _pl_chashmap_shard_t *shard = &map->shards[s];
+        _pl_chashmap_table_t *table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        _pl_chashmap_migrate_internal(shard, table, SIZE_MAX);
+
+        // Keys dropped by a migration live on in the arena, so a shard that
+        // retired a table is rebuilt even if its current table is clean. The
+        // retired list is kept on failure so the next call tries again.
+        size_t length = atomic_load_explicit(&shard->length, memory_order_relaxed);
+        if(!shard->retired && table->used == length) continue;
+        if(_pl_chashmap_compact_internal(shard)) {
+            result = 1;
+            continue;
+        }
+        _pl_chashmap_free_retired_internal(shard);
+    }
+    return result;
+}
+
+size_t pl_chashmap_len(pl_chashmap_t *map) {
+    if(!map) return 0;
+    size_t length = 0;
+    for(int s = 0; s < PL_CHASHMAP_SHARD_COUNT; s++) {
+        length += atomic_load_explicit(&map->shards[s].length, memory_order_relaxed);
+    }
+    return length;
+}
+
 #endif // PLATO_HASHMAP_IMPLEMENTATION
 #endif // PLATO_HASHMAP_H
\ No newline at end of file
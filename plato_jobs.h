@@ -0,0 +1,492 @@
+#ifndef PLATO_JOBS_H
+#define PLATO_JOBS_H
+
+#include "plato_thread.h"
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define PL_JOBS_MAX_THREADS    64
+#define PL_JOBS_DEQUE_CAPACITY 4096
+
+typedef void (*pl_job_func_t)(void *arg);
+typedef void (*pl_job_range_func_t)(void *arg, size_t begin, size_t end);
+
+typedef struct _pl_job_s _pl_job_t;
+typedef struct pl_jobs_s pl_jobs_t;
+
+// Tracks outstanding jobs. Must stay valid until pl_jobs_wait() on it returns
+// and until every job that was scheduled to run after it has started.
+typedef struct pl_jobs_counter_s {
+    atomic_int value;
+    atomic_int busy;
+    _Atomic(_pl_job_t*) waiting;
+} pl_jobs_counter_t;
+
+int pl_jobs_hardware_concurrency(void);
+pl_jobs_t *pl_jobs_init(int thread_count);
+void pl_jobs_destroy(pl_jobs_t *jobs);
+int pl_jobs_thread_count(pl_jobs_t *jobs);
+int pl_jobs_thread_index(pl_jobs_t *jobs);
+void pl_jobs_counter_init(pl_jobs_counter_t *counter);
+int pl_jobs_run(pl_jobs_t *jobs, pl_job_func_t func, void *arg, pl_jobs_counter_t *counter);
+int pl_jobs_run_after(
+    pl_jobs_t *jobs,
+    pl_jobs_counter_t *dependency,
+    pl_job_func_t func,
+    void *arg,
+    pl_jobs_counter_t *counter
+);
+void pl_jobs_wait(pl_jobs_t *jobs, pl_jobs_counter_t *counter);
+int pl_jobs_parallel_for(
+    pl_jobs_t *jobs,
+    size_t count,
+    size_t grain,
+    pl_job_range_func_t func,
+    void *arg
+);
+
+#if defined(PLATO_IMPLEMENTATION) || defined(PLATO_JOBS_IMPLEMENTATION)
+
+#define _PL_JOBS_CACHELINE   64
+#define _PL_JOBS_SPIN_COUNT  64
+
+typedef struct _pl_job_s {
+    pl_job_func_t func;
+    void *arg;
+    pl_jobs_counter_t *counter;
+    struct _pl_job_s *next;
+} _pl_job_t;
+
+// Chase-Lev work-stealing deque with a fixed ring buffer. The owning thread
+// pushes and takes at the bottom, every other thread steals from the top.
+typedef struct _pl_jobs_deque_s {
+    atomic_llong top;
+    char _pad0[_PL_JOBS_CACHELINE - sizeof(atomic_llong)];
+    atomic_llong bottom;
+    char _pad1[_PL_JOBS_CACHELINE - sizeof(atomic_llong)];
+    _Atomic(_pl_job_t*) buffer[PL_JOBS_DEQUE_CAPACITY];
+} _pl_jobs_deque_t;
+
+typedef struct _pl_jobs_worker_s {
+    pl_jobs_t *jobs;
+    int index;
+    pl_thread_t thread;
+} _pl_jobs_worker_t;
+
+typedef struct pl_jobs_s {
+    _pl_jobs_deque_t *deques;
+    _pl_jobs_worker_t *workers;
+    int thread_count;
+
+    pl_mtx_t inject_mtx;
+    _pl_job_t *inject_head;
+    _pl_job_t *inject_tail;
+    atomic_int inject_count;
+
+    pl_mtx_t sleep_mtx;
+    pl_cnd_t sleep_cnd;
+    atomic_int sleepers;
+    atomic_int pending;
+    atomic_int quit;
+} pl_jobs_t;
+
+static _Thread_local pl_jobs_t *_pl_jobs_tls_pool = NULL;
+static _Thread_local int _pl_jobs_tls_index = -1;
+static _Thread_local uint32_t _pl_jobs_tls_rng = 0;
+
+int pl_jobs_hardware_concurrency(void) {
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static int _pl_jobs_deque_push_internal(_pl_jobs_deque_t *dq, _pl_job_t *job) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed);
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    if(b - t >= PL_JOBS_DEQUE_CAPACITY) return 1;
+
+    atomic_store_explicit(&dq->buffer[b & (PL_JOBS_DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+    return 0;
+}
+
+static _pl_job_t *_pl_jobs_deque_take_internal(_pl_jobs_deque_t *dq) {
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&dq->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long t = atomic_load_explicit(&dq->top, memory_order_relaxed);
+
+    _pl_job_t *job = NULL;
+    if(t <= b) {
+        job = atomic_load_explicit(&dq->buffer[b & (PL_JOBS_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+        if(t == b) {
+            // Last item, race against thieves for it
+            if(!atomic_compare_exchange_strong_explicit(
+                &dq->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+                job = NULL;
+            }
+            atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+        }
+    }
+    else atomic_store_explicit(&dq->bottom, b + 1, memory_order_relaxed);
+
+    return job;
+}
+
+static _pl_job_t *_pl_jobs_deque_steal_internal(_pl_jobs_deque_t *dq) {
+    long long t = atomic_load_explicit(&dq->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&dq->bottom, memory_order_acquire);
+    if(t >= b) return NULL;
+
+    _pl_job_t *job = atomic_load_explicit(&dq->buffer[t & (PL_JOBS_DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if(!atomic_compare_exchange_strong_explicit(
+        &dq->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return job;
+}
+
+static void _pl_jobs_wake_internal(pl_jobs_t *jobs) {
+    if(atomic_load(&jobs->sleepers) > 0) {
+        pl_mtx_lock(&jobs->sleep_mtx);
+        pl_cnd_signal(&jobs->sleep_cnd);
+        pl_mtx_unlock(&jobs->sleep_mtx);
+    }
+}
+
+static void _pl_jobs_execute_internal(pl_jobs_t *jobs, _pl_job_t *job);
+
+static void _pl_jobs_submit_internal(pl_jobs_t *jobs, _pl_job_t *job) {
+    int index = pl_jobs_thread_index(jobs);
+
+    if(index >= 0) {
+        atomic_fetch_add(&jobs->pending, 1);
+        if(_pl_jobs_deque_push_internal(&jobs->deques[index], job) != 0) {
+            // Deque is full, run the job inline rather than failing
+            atomic_fetch_sub(&jobs->pending, 1);
+            _pl_jobs_execute_internal(jobs, job);
+            return;
+        }
+    }
+    else {
+        job->next = NULL;
+        pl_mtx_lock(&jobs->inject_mtx);
+        if(jobs->inject_tail) jobs->inject_tail->next = job;
+        else jobs->inject_head = job;
+        jobs->inject_tail = job;
+        atomic_fetch_add(&jobs->inject_count, 1);
+        atomic_fetch_add(&jobs->pending, 1);
+        pl_mtx_unlock(&jobs->inject_mtx);
+    }
+
+    _pl_jobs_wake_internal(jobs);
+}
+
+static void _pl_jobs_release_waiting_internal(pl_jobs_t *jobs, pl_jobs_counter_t *counter) {
+    _pl_job_t *job = atomic_exchange(&counter->waiting, NULL);
+    while(job) {
+        _pl_job_t *next = job->next;
+        _pl_jobs_submit_internal(jobs, job);
+        job = next;
+    }
+}
+
+static void _pl_jobs_execute_internal(pl_jobs_t *jobs, _pl_job_t *job) {
+    pl_jobs_counter_t *counter = job->counter;
+    job->func(job->arg);
+    free(job);
+
+    if(counter) {
+        // 'busy' keeps pl_jobs_wait() from returning while the counter is still being touched
+        atomic_fetch_add(&counter->busy, 1);
+        if(atomic_fetch_sub(&counter->value, 1) == 1) _pl_jobs_release_waiting_internal(jobs, counter);
+        atomic_fetch_sub(&counter->busy, 1);
+    }
+}
+
+static _pl_job_t *_pl_jobs_find_internal(pl_jobs_t *jobs, int index) {
+    _pl_job_t *job = NULL;
+
+    if(index >= 0) job = _pl_jobs_deque_take_internal(&jobs->deques[index]);
+
+    if(!job && atomic_load(&jobs->inject_count) > 0) {
+        pl_mtx_lock(&jobs->inject_mtx);
+        job = jobs->inject_head;
+        if(job) {
+            jobs->inject_head = job->next;
+            if(!jobs->inject_head) jobs->inject_tail = NULL;
+            atomic_fetch_sub(&jobs->inject_count, 1);
+        }
+        pl_mtx_unlock(&jobs->inject_mtx);
+    }
+
+    if(!job) {
+        if(_pl_jobs_tls_rng == 0) _pl_jobs_tls_rng = (uint32_t)(uintptr_t)&job | 1u;
+        _pl_jobs_tls_rng ^= _pl_jobs_tls_rng << 13;
+        _pl_jobs_tls_rng ^= _pl_jobs_tls_rng >> 17;
+        _pl_jobs_tls_rng ^= _pl_jobs_tls_rng << 5;
+
+        int start = (int)(_pl_jobs_tls_rng % (uint32_t)jobs->thread_count);
+        for(int i = 0; i < jobs->thread_count && !job; i++) {
+            int victim = (start + i) % jobs->thread_count;
+            if(victim != index) job = _pl_jobs_deque_steal_internal(&jobs->deques[victim]);
+        }
+    }
+
+    if(job) atomic_fetch_sub(&jobs->pending, 1);
+    return job;
+}
+
+static int _pl_jobs_try_run_internal(pl_jobs_t *jobs, int index) {
+    _pl_job_t *job = _pl_jobs_find_internal(jobs, index);
+    if(!job) return 0;
+    _pl_jobs_execute_internal(jobs, job);
+    return 1;
+}
+
+static int _pl_jobs_worker_main_internal(void *arg) {
+    _pl_jobs_worker_t *worker = (_pl_jobs_worker_t*)arg;
+    pl_jobs_t *jobs = worker->jobs;
+    int spins = 0;
+
+    _pl_jobs_tls_pool = jobs;
+    _pl_jobs_tls_index = worker->index;
+
+    while(!atomic_load(&jobs->quit)) {
+        if(_pl_jobs_try_run_internal(jobs, worker->index)) {
+            spins = 0;
+            continue;
+        }
+
+        if(++spins < _PL_JOBS_SPIN_COUNT) {
+            pl_thread_yield();
+            continue;
+        }
+
+        pl_mtx_lock(&jobs->sleep_mtx);
+        atomic_fetch_add(&jobs->sleepers, 1);
+        if(atomic_load(&jobs->pending) == 0 && !atomic_load(&jobs->quit)) {
+            pl_cnd_wait(&jobs->sleep_cnd, &jobs->sleep_mtx);
+        }
+        atomic_fetch_sub(&jobs->sleepers, 1);
+        pl_mtx_unlock(&jobs->sleep_mtx);
+        spins = 0;
+    }
+
+    _pl_jobs_tls_pool = NULL;
+    _pl_jobs_tls_index = -1;
+    return 0;
+}
+
+pl_jobs_t *pl_jobs_init(int thread_count) {
+    if(thread_count <= 0) thread_count = pl_jobs_hardware_concurrency();
+    if(thread_count > PL_JOBS_MAX_THREADS) thread_count = PL_JOBS_MAX_THREADS;
+
+    pl_jobs_t *jobs = (pl_jobs_t*)calloc(1, sizeof(pl_jobs_t));
+    if(!jobs) return NULL;
+
+    jobs->thread_count = thread_count;
+    jobs->deques = (_pl_jobs_deque_t*)calloc((size_t)thread_count, sizeof(_pl_jobs_deque_t));
+    jobs->workers = (_pl_jobs_worker_t*)calloc((size_t)thread_count, sizeof(_pl_jobs_worker_t));
+    if(!jobs->deques || !jobs->workers) {
+        free(jobs->deques);
+        free(jobs->workers);
+        free(jobs);
+        return NULL;
+    }
+
+    pl_mtx_init(&jobs->inject_mtx, PL_MTX_PLAIN);
+    pl_mtx_init(&jobs->sleep_mtx, PL_MTX_PLAIN);
+    pl_cnd_init(&jobs->sleep_cnd);
+    atomic_init(&jobs->sleepers, 0);
+    atomic_init(&jobs->pending, 0);
+    atomic_init(&jobs->quit, 0);
+    atomic_init(&jobs->inject_count, 0);
+
+    for(int i = 0; i < thread_count; i++) {
+        atomic_init(&jobs->deques[i].top, 0);
+        atomic_init(&jobs->deques[i].bottom, 0);
+        jobs->workers[i].jobs = jobs;
+        jobs->workers[i].index = i;
+    }
+
+    // The creating thread owns slot 0 and runs jobs whenever it waits
+    if(!_pl_jobs_tls_pool) {
+        _pl_jobs_tls_pool = jobs;
+        _pl_jobs_tls_index = 0;
+    }
+
+    for(int i = 1; i < thread_count; i++) {
+        if(pl_thread_create(&jobs->workers[i].thread, _pl_jobs_worker_main_internal, &jobs->workers[i]) != PL_THREAD_SUCCESS) {
+            jobs->thread_count = i;
+            break;
+        }
+    }
+
+    return jobs;
+}
+
+void pl_jobs_destroy(pl_jobs_t *jobs) {
+    if(!jobs) return;
+
+    pl_mtx_lock(&jobs->sleep_mtx);
+    atomic_store(&jobs->quit, 1);
+    pl_cnd_broadcast(&jobs->sleep_cnd);
+    pl_mtx_unlock(&jobs->sleep_mtx);
+
+    for(int i = 1; i < jobs->thread_count; i++) pl_thread_join(jobs->workers[i].thread, NULL);
+
+    if(_pl_jobs_tls_pool == jobs) {
+        _pl_jobs_tls_pool = NULL;
+        _pl_jobs_tls_index = -1;
+    }
+
+    pl_cnd_destroy(&jobs->sleep_cnd);
+    pl_mtx_destroy(&jobs->sleep_mtx);
+    pl_mtx_destroy(&jobs->inject_mtx);
+    free(jobs->deques);
+    free(jobs->workers);
+    free(jobs);
+}
+
+int pl_jobs_thread_count(pl_jobs_t *jobs) {
+    return jobs ? jobs->thread_count : 1;
+}
+
+int pl_jobs_thread_index(pl_jobs_t *jobs) {
+    return (jobs && _pl_jobs_tls_pool == jobs) ? _pl_jobs_tls_index : -1;
+}
+
+void pl_jobs_counter_init(pl_jobs_counter_t *counter) {
+    atomic_init(&counter->value, 0);
+    atomic_init(&counter->busy, 0);
+    atomic_init(&counter->waiting, NULL);
+}
+
+static _pl_job_t *_pl_jobs_alloc_internal(pl_job_func_t func, void *arg, pl_jobs_counter_t *counter) {
+    _pl_job_t *job = (_pl_job_t*)malloc(sizeof(_pl_job_t));
+    if(!job) return NULL;
+    job->func = func;
+    job->arg = arg;
+    job->counter = counter;
+    job->next = NULL;
+    if(counter) atomic_fetch_add(&counter->value, 1);
+    return job;
+}
+
+int pl_jobs_run(pl_jobs_t *jobs, pl_job_func_t func, void *arg, pl_jobs_counter_t *counter) {
+    if(!func) return 1;
+    if(!jobs) {
+        func(arg);
+        return 0;
+    }
+
+    _pl_job_t *job = _pl_jobs_alloc_internal(func, arg, counter);
+    if(!job) return 1;
+    _pl_jobs_submit_internal(jobs, job);
+    return 0;
+}
+
+int pl_jobs_run_after(
+    pl_jobs_t *jobs,
+    pl_jobs_counter_t *dependency,
+    pl_job_func_t func,
+    void *arg,
+    pl_jobs_counter_t *counter
+) {
+    if(!dependency || !jobs) {
+        if(jobs && dependency) pl_jobs_wait(jobs, dependency);
+        return pl_jobs_run(jobs, func, arg, counter);
+    }
+    if(!func) return 1;
+
+    _pl_job_t *job = _pl_jobs_alloc_internal(func, arg, counter);
+    if(!job) return 1;
+
+    _pl_job_t *head = atomic_load(&dependency->waiting);
+    do {
+        job->next = head;
+    } while(!atomic_compare_exchange_weak(&dependency->waiting, &head, job));
+
+    // The dependency may have completed before we were linked in, in which
+    // case no finishing job will see us and we release the list ourselves
+    if(atomic_load(&dependency->value) == 0) _pl_jobs_release_waiting_internal(jobs, dependency);
+    return 0;
+}
+
+void pl_jobs_wait(pl_jobs_t *jobs, pl_jobs_counter_t *counter) {
+    if(!counter) return;
+
+    int index = pl_jobs_thread_index(jobs);
+    while(atomic_load(&counter->value) > 0 || atomic_load(&counter->busy) > 0) {
+        if(!jobs || !_pl_jobs_try_run_internal(jobs, index)) pl_thread_yield();
+    }
+}
+
+typedef struct _pl_jobs_range_s {
+    pl_job_range_func_t func;
+    void *arg;
+    size_t begin;
+    size_t end;
+} _pl_jobs_range_t;
+
+static void _pl_jobs_range_internal(void *arg) {
+    _pl_jobs_range_t *range = (_pl_jobs_range_t*)arg;
+    range->func(range->arg, range->begin, range->end);
+}
+
+int pl_jobs_parallel_for(
+    pl_jobs_t *jobs,
+    size_t count,
+    size_t grain,
+    pl_job_range_func_t func,
+    void *arg
+) {
+    if(!func) return 1;
+    if(count == 0) return 0;
+
+    if(grain == 0) {
+        size_t threads = (size_t)pl_jobs_thread_count(jobs);
+        grain = count / (threads * 4);
+        if(grain == 0) grain = 1;
+    }
+
+    size_t chunk_count = (count + grain - 1) / grain;
+    if(!jobs || chunk_count == 1) {
+        func(arg, 0, count);
+        return 0;
+    }
+
+    _pl_jobs_range_t *ranges = (_pl_jobs_range_t*)malloc(sizeof(_pl_jobs_range_t) * chunk_count);
+    if(!ranges) {
+        func(arg, 0, count);
+        return 0;
+    }
+
+    pl_jobs_counter_t counter;
+    pl_jobs_counter_init(&counter);
+
+    for(size_t i = 0; i < chunk_count; i++) {
+        ranges[i].func = func;
+        ranges[i].arg = arg;
+        ranges[i].begin = i * grain;
+        ranges[i].end = (i + 1) * grain < count ? (i + 1) * grain : count;
+        if(pl_jobs_run(jobs, _pl_jobs_range_internal, &ranges[i], &counter) != 0) {
+            _pl_jobs_range_internal(&ranges[i]);
+        }
+    }
+
+    pl_jobs_wait(jobs, &counter);
+    free(ranges);
+    return 0;
+}
+
+#endif // PLATO_JOBS_IMPLEMENTATION
+#endif // PLATO_JOBS_H
\ No newline at end of file
@@ -3,30 +3,49 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
-typedef struct pl_pack_rect_t;
-
-int pl_pack_rects(
-    pl_pack_rect_t *rects, int rect_count, 
-    int container_w, int container_h, 
-    int padding
-);
-
-#if defined(PLATO_IMPLEMENTATION) || defined(PLATO_PACK_IMPLEMENTATION)
+// Placement heuristics for pl_pack_rects_pages. The MaxRects ones keep every
+// maximal free rectangle of a page and pick the one leaving the shortest
+// leftover side (BSSF), the shortest longest side (BLSF), the least area
+// (BAF) or the lowest top edge (BL). The Skyline ones only track the top
+// contour of each page, which is faster but packs less tightly, and pick the
+// lowest top edge (BL) or the least area trapped under the rect (MIN_WASTE).
+#define PL_PACK_MAXRECTS_BSSF     0
+#define PL_PACK_MAXRECTS_BLSF     1
+#define PL_PACK_MAXRECTS_BAF      2
+#define PL_PACK_MAXRECTS_BL       3
+#define PL_PACK_SKYLINE_BL        4
+#define PL_PACK_SKYLINE_MIN_WASTE 5
 
 typedef struct pl_pack_rect_s {
     int x, y;
     int w, h;
     int obj_idx;
+    int page;
 } pl_pack_rect_t;
 
-int _pl_pack_compare_rect_h_internal(const void *a, const void *b) {
+int pl_pack_rects(
+    pl_pack_rect_t *rects, int rect_count,
+    int container_w, int container_h,
+    int padding
+);
+int pl_pack_rects_pages(
+    pl_pack_rect_t *rects, int rect_count,
+    int container_w, int container_h,
+    int padding, int method,
+    int max_pages, int *page_count
+);
+
+#if defined(PLATO_IMPLEMENTATION) || defined(PLATO_PACK_IMPLEMENTATION)
+
+static int _pl_pack_compare_rect_h_internal(const void *a, const void *b) {
     return ((pl_pack_rect_t*)b)->h - ((pl_pack_rect_t*)a)->h;
 }
 
 int pl_pack_rects(
-    pl_pack_rect_t *rects, int rect_count, 
-    int container_w, int container_h, 
+    pl_pack_rect_t *rects, int rect_count,
+    int container_w, int container_h,
     int padding
 ) {
     qsort(rects, rect_count, sizeof(pl_pack_rect_t), _pl_pack_compare_rect_h_internal);
@@ -48,6 +67,7 @@ int pl_pack_rects(
 
         rect->x += pos_x;
         rect->y += pos_y;
+        rect->page = 0;
 
         pos_x += rect->w + padding;
         if(rect->h > max_row_h) max_row_h = rect->h;
@@ -56,5 +76,320 @@ int pl_pack_rects(
     return 0;
 }
 
+typedef struct _pl_pack_box_s {
+    int x, y;
+    int w, h;
+} _pl_pack_box_t;
+
+// Free rectangles for MaxRects, or skyline segments (x, y, w) for Skyline
+typedef struct _pl_pack_page_s {
+    _pl_pack_box_t *boxes;
+    int count;
+    int capacity;
+} _pl_pack_page_t;
+
+typedef struct _pl_pack_item_s {
+    int idx;
+    int w, h;
+    int x, y;
+    int page;
+} _pl_pack_item_t;
+
+typedef struct _pl_pack_fit_s {
+    int page;
+    int index;
+    int x, y;
+    long long score1, score2;
+} _pl_pack_fit_t;
+
+static int _pl_pack_insert_internal(_pl_pack_page_t *page, int index, _pl_pack_box_t box) {
+    if(page->count == page->capacity) {
+        int capacity = page->capacity ? page->capacity * 2 : 16;
+        _pl_pack_box_t *boxes = (_pl_pack_box_t*)realloc(page->boxes, sizeof(_pl_pack_box_t) * capacity);
+        if(!boxes) return 1;
+        page->boxes = boxes;
+        page->capacity = capacity;
+    }
+    memmove(&page->boxes[index + 1], &page->boxes[index], sizeof(_pl_pack_box_t) * (page->count - index));
+    page->boxes[index] = box;
+    page->count++;
+    return 0;
+}
+
+static void _pl_pack_remove_internal(_pl_pack_page_t *page, int index) {
+    memmove(&page->boxes[index], &page->boxes[index + 1], sizeof(_pl_pack_box_t) * (page->count - index - 1));
+    page->count--;
+}
+
+// Largest rects first, so the small ones fill the gaps they leave
+static int _pl_pack_compare_item_internal(const void *a, const void *b) {
+    const _pl_pack_item_t *ia = (const _pl_pack_item_t*)a;
+    const _pl_pack_item_t *ib = (const _pl_pack_item_t*)b;
+    int a_max = ia->w > ia->h ? ia->w : ia->h, a_min = ia->w > ia->h ? ia->h : ia->w;
+    int b_max = ib->w > ib->h ? ib->w : ib->h, b_min = ib->w > ib->h ? ib->h : ib->w;
+    if(a_max != b_max) return b_max - a_max;
+    if(a_min != b_min) return b_min - a_min;
+    return ia->idx - ib->idx;
+}
+
+static int _pl_pack_better_internal(_pl_pack_fit_t *fit, long long score1, long long score2) {
+    return fit->page < 0 || score1 < fit->score1 || (score1 == fit->score1 && score2 < fit->score2);
+}
+
+static void _pl_pack_maxrects_find_internal(_pl_pack_page_t *page, int page_idx, int w, int h, int method, _pl_pack_fit_t *fit) {
+    for(int i = 0; i < page->count; i++) {
+        _pl_pack_box_t *f = &page->boxes[i];
+        if(w > f->w || h > f->h) continue;
+
+        long long leftover_w = f->w - w, leftover_h = f->h - h;
+        long long short_side = leftover_w < leftover_h ? leftover_w : leftover_h;
+        long long long_side = leftover_w < leftover_h ? leftover_h : leftover_w;
+        long long score1, score2;
+        switch(method) {
+            case PL_PACK_MAXRECTS_BLSF: score1 = long_side; score2 = short_side; break;
+            case PL_PACK_MAXRECTS_BAF: score1 = (long long)f->w * f->h - (long long)w * h; score2 = short_side; break;
+            case PL_PACK_MAXRECTS_BL: score1 = (long long)f->y + h; score2 = f->x; break;
+            default: score1 = short_side; score2 = long_side; break;
+        }
+        if(_pl_pack_better_internal(fit, score1, score2)) {
+            fit->page = page_idx;
+            fit->index = i;
+            fit->x = f->x;
+            fit->y = f->y;
+            fit->score1 = score1;
+            fit->score2 = score2;
+        }
+    }
+}
+
+static int _pl_pack_contains_internal(_pl_pack_box_t *a, _pl_pack_box_t *b) {
+    return b->x >= a->x && b->y >= a->y && b->x + b->w <= a->x + a->w && b->y + b->h <= a->y + a->h;
+}
+
+static int _pl_pack_overlaps_internal(_pl_pack_box_t *a, _pl_pack_box_t *b) {
+    return a->x < b->x + b->w && b->x < a->x + a->w && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+// Splits every free rect the placed one overlaps into the up to four
+// maximal rects around it, then drops free rects contained in another.
+// Untouched rects were already maximal among themselves, so only pairs
+// involving a new piece need checking.
+static int _pl_pack_maxrects_place_internal(_pl_pack_page_t *page, _pl_pack_page_t *scratch, _pl_pack_box_t used) {
+    scratch->count = 0;
+    for(int i = 0; i < page->count; i++) {
+        if(_pl_pack_overlaps_internal(&page->boxes[i], &used)) continue;
+        if(_pl_pack_insert_internal(scratch, scratch->count, page->boxes[i])) return 1;
+    }
+    int first_piece = scratch->count;
+
+    for(int i = 0; i < page->count; i++) {
+        _pl_pack_box_t f = page->boxes[i];
+        if(!_pl_pack_overlaps_internal(&f, &used)) continue;
+
+        _pl_pack_box_t pieces[4];
+        int n = 0;
+        if(used.y > f.y) pieces[n++] = (_pl_pack_box_t){f.x, f.y, f.w, used.y - f.y};
+        if(used.y + used.h < f.y + f.h) pieces[n++] = (_pl_pack_box_t){f.x, used.y + used.h, f.w, f.y + f.h - used.y - used.h};
+        if(used.x > f.x) pieces[n++] = (_pl_pack_box_t){f.x, f.y, used.x - f.x, f.h};
+        if(used.x + used.w < f.x + f.w) pieces[n++] = (_pl_pack_box_t){used.x + used.w, f.y, f.x + f.w - used.x - used.w, f.h};
+        for(int p = 0; p < n; p++) {
+            if(_pl_pack_insert_internal(scratch, scratch->count, pieces[p])) return 1;
+        }
+    }
+
+    for(int i = 0; i < scratch->count; i++) {
+        for(int j = i < first_piece ? first_piece : 0; j < scratch->count; j++) {
+            if(i == j || !_pl_pack_contains_internal(&scratch->boxes[j], &scratch->boxes[i])) continue;
+            _pl_pack_remove_internal(scratch, i);
+            if(i < first_piece) first_piece--;
+            i--;
+            break;
+        }
+    }
+
+    _pl_pack_page_t t = *page;
+    *page = *scratch;
+    *scratch = t;
+    return 0;
+}
+
+// Lowest y at which a w x h rect can sit with its left edge on segment i,
+// or -1 if it would stick out of the page
+static int _pl_pack_skyline_fit_internal(_pl_pack_page_t *page, int i, int w, int h, int page_w, int page_h) {
+    int x = page->boxes[i].x;
+    if(x + w > page_w) return -1;
+    int y = 0;
+    for(int j = i, left = w; left > 0; j++) {
+        if(page->boxes[j].y > y) y = page->boxes[j].y;
+        if(y + h > page_h) return -1;
+        left -= page->boxes[j].w;
+    }
+    return y;
+}
+
+static long long _pl_pack_skyline_waste_internal(_pl_pack_page_t *page, int i, int w, int y) {
+    long long waste = 0;
+    for(int j = i, left = w; left > 0; j++) {
+        int span = page->boxes[j].w < left ? page->boxes[j].w : left;
+        waste += (long long)(y - page->boxes[j].y) * span;
+        left -= page->boxes[j].w;
+    }
+    return waste;
+}
+
+static void _pl_pack_skyline_find_internal(_pl_pack_page_t *page, int page_idx, int w, int h, int page_w, int page_h, int method, _pl_pack_fit_t *fit) {
+    for(int i = 0; i < page->count; i++) {
+        int y = _pl_pack_skyline_fit_internal(page, i, w, h, page_w, page_h);
+        if(y < 0) continue;
+
+        long long score1, score2;
+        if(method == PL_PACK_SKYLINE_MIN_WASTE) {
+            score1 = _pl_pack_skyline_waste_internal(page, i, w, y);
+            score2 = (long long)y + h;
+        }
+        else {
+            score1 = (long long)y + h;
+            score2 = page->boxes[i].w;
+        }
+        if(_pl_pack_better_internal(fit, score1, score2)) {
+            fit->page = page_idx;
+            fit->index = i;
+            fit->x = page->boxes[i].x;
+            fit->y = y;
+            fit->score1 = score1;
+            fit->score2 = score2;
+        }
+    }
+}
+
+// Raises the skyline over the placed rect, trimming the segments it covers
+// and merging neighbours left at the same height
+static int _pl_pack_skyline_place_internal(_pl_pack_page_t *page, int index, _pl_pack_box_t used) {
+    _pl_pack_box_t segment = {used.x, used.y + used.h, used.w, 0};
+    if(_pl_pack_insert_internal(page, index, segment)) return 1;
+
+    for(int j = index + 1; j < page->count;) {
+        _pl_pack_box_t *prev = &page->boxes[j - 1];
+        _pl_pack_box_t *cur = &page->boxes[j];
+        int overlap = prev->x + prev->w - cur->x;
+        if(overlap <= 0) break;
+        cur->x += overlap;
+        cur->w -= overlap;
+        if(cur->w > 0) break;
+        _pl_pack_remove_internal(page, j);
+    }
+
+    for(int j = 0; j + 1 < page->count;) {
+        if(page->boxes[j].y == page->boxes[j + 1].y) {
+            page->boxes[j].w += page->boxes[j + 1].w;
+            _pl_pack_remove_internal(page, j + 1);
+        }
+        else j++;
+    }
+    return 0;
+}
+
+static int _pl_pack_add_page_internal(_pl_pack_page_t **pages, int *page_count, int page_w, int page_h) {
+    _pl_pack_page_t *grown = (_pl_pack_page_t*)realloc(*pages, sizeof(_pl_pack_page_t) * (*page_count + 1));
+    if(!grown) return 1;
+    *pages = grown;
+
+    _pl_pack_page_t *page = &grown[*page_count];
+    page->boxes = NULL;
+    page->count = 0;
+    page->capacity = 0;
+    _pl_pack_box_t all = {0, 0, page_w, page_h};
+    if(_pl_pack_insert_internal(page, 0, all)) return 1;
+    (*page_count)++;
+    return 0;
+}
+
+// Packs every rect without reordering 'rects', opening another page of
+// container_w x container_h whenever none of the open ones has room, and
+// writes x, y and the page index into each rect. 'padding' is kept between
+// rects and around the page border. 'max_pages' <= 0 means no limit.
+// Returns 0 on success and the number of pages used in 'page_count'; returns
+// 1 without touching 'rects' if a rect is larger than a page, the page limit
+// is hit or an allocation fails.
+int pl_pack_rects_pages(
+    pl_pack_rect_t *rects, int rect_count,
+    int container_w, int container_h,
+    int padding, int method,
+    int max_pages, int *page_count
+) {
+    if(page_count) *page_count = 0;
+    if(rect_count <= 0) return rect_count < 0;
+    if(!rects || padding < 0 || method < PL_PACK_MAXRECTS_BSSF || method > PL_PACK_SKYLINE_MIN_WASTE) return 1;
+
+    // Each rect claims its padding on the right and bottom, and the page
+    // loses the same amount on the left and top
+    int page_w = container_w - padding;
+    int page_h = container_h - padding;
+    _pl_pack_item_t *items = (_pl_pack_item_t*)malloc(sizeof(_pl_pack_item_t) * rect_count);
+    if(!items) return 1;
+    for(int i = 0; i < rect_count; i++) {
+        items[i].idx = i;
+        items[i].w = rects[i].w + padding;
+        items[i].h = rects[i].h + padding;
+        if(rects[i].w < 0 || rects[i].h < 0 || items[i].w > page_w || items[i].h > page_h) {
+            free(items);
+            return 1;
+        }
+    }
+    qsort(items, rect_count, sizeof(_pl_pack_item_t), _pl_pack_compare_item_internal);
+
+    int skyline = method >= PL_PACK_SKYLINE_BL;
+    _pl_pack_page_t *pages = NULL;
+    _pl_pack_page_t scratch = {NULL, 0, 0};
+    int pages_used = 0;
+    int result = 0;
+
+    for(int i = 0; i < rect_count && result == 0; i++) {
+        _pl_pack_item_t *item = &items[i];
+        if(item->w == 0 || item->h == 0) {
+            if(pages_used == 0 && _pl_pack_add_page_internal(&pages, &pages_used, page_w, page_h)) result = 1;
+            item->x = item->y = item->page = 0;
+            continue;
+        }
+
+        _pl_pack_fit_t fit = {-1, 0, 0, 0, 0, 0};
+        for(int p = 0; p < pages_used; p++) {
+            if(skyline) _pl_pack_skyline_find_internal(&pages[p], p, item->w, item->h, page_w, page_h, method, &fit);
+            else _pl_pack_maxrects_find_internal(&pages[p], p, item->w, item->h, method, &fit);
+        }
+        if(fit.page < 0) {
+            if((max_pages > 0 && pages_used == max_pages) || _pl_pack_add_page_internal(&pages, &pages_used, page_w, page_h)) {
+                result = 1;
+                break;
+            }
+            if(skyline) _pl_pack_skyline_find_internal(&pages[pages_used - 1], pages_used - 1, item->w, item->h, page_w, page_h, method, &fit);
+            else _pl_pack_maxrects_find_internal(&pages[pages_used - 1], pages_used - 1, item->w, item->h, method, &fit);
+        }
+
+        _pl_pack_box_t used = {fit.x, fit.y, item->w, item->h};
+        if(skyline) result = _pl_pack_skyline_place_internal(&pages[fit.page], fit.index, used);
+        else result = _pl_pack_maxrects_place_internal(&pages[fit.page], &scratch, used);
+        item->x = fit.x;
+        item->y = fit.y;
+        item->page = fit.page;
+    }
+
+    if(result == 0) {
+        for(int i = 0; i < rect_count; i++) {
+            pl_pack_rect_t *rect = &rects[items[i].idx];
+            rect->x = items[i].x + padding;
+            rect->y = items[i].y + padding;
+            rect->page = items[i].page;
+        }
+        if(page_count) *page_count = pages_used;
+    }
+
+    for(int p = 0; p < pages_used; p++) free(pages[p].boxes);
+    free(pages);
+    free(scratch.boxes);
+    free(items);
+    return result;
+}
+
 #endif // PLATO_PACK_IMPLEMENTATION
 #endif // PLATO_PACK_H
\ No newline at end of file
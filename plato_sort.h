@@ -2,21 +2,227 @@
 #define PLATO_SORT_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plato_jobs.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define PL_SORT_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define PL_SORT_SSE
+#endif
+
+// Ranges of at most this many elements are finished with insertion sort
+#define PL_SORT_INSERTION_THRESHOLD 16
+// Ranges larger than this pick the pivot as a median of three medians
+#define PL_SORT_NINTHER_THRESHOLD 128
+
+// Flag for pl_parallel_sort: keep equal elements in their input order
+#define PL_SORT_STABLE 1
+// Inputs smaller than this are sorted serially; also the smallest chunk
+// handed to a worker
+#define PL_PARALLEL_SORT_THRESHOLD 16384
+// Upper bound on the chunks sorted and the parts merged in parallel
+#define PL_PARALLEL_SORT_MAX_PARTS 128
+
+// Largest input of the pl_sort_network_* kernels
+#define PL_SORT_NETWORK_MAX 64
+
+#define PL_RADIX_SORT_BITS 11
+// Below this many keys the radix sorts fall back to insertion sort, or to
+// the sorting network for keys without a payload
+#define PL_RADIX_SORT_SMALL 64
 
 void pl_qsort_r(
-    void *base, 
-    size_t num, 
-    size_t size, 
-    int (*cmp)(const void *, const void *, void *), 
+    void *base,
+    size_t num,
+    size_t size,
+    int (*cmp)(const void *, const void *, void *),
     void *arg
 );
 
+// Bitonic sorting networks for up to PL_SORT_NETWORK_MAX keys, vectorized
+// with AVX2 or SSE2 when available. Inputs are padded to the next power of
+// two from 8 to 64. The _kv variants move a uint32_t payload with each key but
+// are not stable. Floats order like the radix sorts below. Return 0 on
+// success, 1 if 'num' exceeds PL_SORT_NETWORK_MAX.
+int pl_sort_network_f32(float *keys, size_t num);
+int pl_sort_network_i32(int32_t *keys, size_t num);
+int pl_sort_network_u32(uint32_t *keys, size_t num);
+int pl_sort_network_f32_kv(float *keys, uint32_t *values, size_t num);
+int pl_sort_network_i32_kv(int32_t *keys, uint32_t *values, size_t num);
+int pl_sort_network_u32_kv(uint32_t *keys, uint32_t *values, size_t num);
+
+// LSD radix sorts with 11-bit digits. Each needs scratch space of the same
+// size as the arrays it sorts, so no memory is allocated; the result always
+// ends up back in 'keys'. The sorts are stable, so the _kv variants keep
+// the input order of equal keys and can carry an index as the payload.
+// Floats order as -inf < ... < -0.0 < 0.0 < ... < inf, with NaNs at either
+// end depending on their sign bit. Return 0 on success, 1 if a scratch
+// buffer is NULL or 'num' exceeds UINT32_MAX.
+int pl_radix_sort_u32(uint32_t *keys, size_t num, uint32_t *scratch);
+int pl_radix_sort_u64(uint64_t *keys, size_t num, uint64_t *scratch);
+int pl_radix_sort_f32(float *keys, size_t num, float *scratch);
+int pl_radix_sort_u32_kv(uint32_t *keys, uint32_t *values, size_t num, uint32_t *key_scratch, uint32_t *value_scratch);
+int pl_radix_sort_u64_kv(uint64_t *keys, uint32_t *values, size_t num, uint64_t *key_scratch, uint32_t *value_scratch);
+int pl_radix_sort_f32_kv(float *keys, uint32_t *values, size_t num, float *key_scratch, uint32_t *value_scratch);
+int pl_parallel_sort(
+    pl_jobs_t *jobs,
+    void *base,
+    size_t num,
+    size_t size,
+    int (*cmp)(const void *, const void *, void *),
+    void *arg,
+    int flags
+);
+// Stably merges the sorted runs src[run_offsets[i], run_offsets[i + 1]) for
+// i < run_count into 'dst', which must not overlap 'src' and receives
+// run_offsets[run_count] - run_offsets[0] elements. Equal elements come out
+// in run order. Returns 0 on success, 1 on bad arguments or allocation failure.
+int pl_parallel_merge(
+    pl_jobs_t *jobs,
+    const void *src,
+    void *dst,
+    size_t size,
+    const size_t *run_offsets,
+    size_t run_count,
+    int (*cmp)(const void *, const void *, void *),
+    void *arg
+);
+
+// Quicksort recursion budget before falling back to heapsort: 2 * log2(num)
+static inline int _pl_sort_depth_limit_internal(size_t num) {
+    int depth = 0;
+    while(num > 1) {
+        num >>= 1;
+        depth += 2;
+    }
+    return depth;
+}
+
+// Generates 'void name(T *base, size_t num)', an introsort with the same
+// strategy as pl_qsort_r where 'less(a, b)' takes two T values and returns
+// non-zero when a orders before b. Being a macro or static inline function,
+// 'less' is inlined into the sort loops.
+//
+//   #define FLOAT_LESS(a, b) ((a) < (b))
+//   PL_SORT_DEFINE(sort_floats, float, FLOAT_LESS)
+#define PL_SORT_DEFINE(name, T, less) \
+    static inline void name##_insertion_internal(T *a, size_t n) { \
+        for(size_t i = 1; i < n; i++) { \
+            T v = a[i]; \
+            size_t j = i; \
+            while(j > 0 && less(v, a[j - 1])) { \
+                a[j] = a[j - 1]; \
+                j--; \
+            } \
+            a[j] = v; \
+        } \
+    } \
+    \
+    static inline void name##_sift_internal(T *a, size_t root, size_t n) { \
+        T v = a[root]; \
+        for(;;) { \
+            size_t child = 2 * root + 1; \
+            if(child >= n) break; \
+            if(child + 1 < n && less(a[child], a[child + 1])) child++; \
+            if(!less(v, a[child])) break; \
+            a[root] = a[child]; \
+            root = child; \
+        } \
+        a[root] = v; \
+    } \
+    \
+    static inline void name##_heapsort_internal(T *a, size_t n) { \
+        for(size_t i = n / 2; i-- > 0;) name##_sift_internal(a, i, n); \
+        while(n > 1) { \
+            n--; \
+            T tmp = a[0]; \
+            a[0] = a[n]; \
+            a[n] = tmp; \
+            name##_sift_internal(a, 0, n); \
+        } \
+    } \
+    \
+    static inline size_t name##_median3_internal(T *a, size_t i, size_t j, size_t k) { \
+        if(less(a[i], a[j])) { \
+            if(less(a[j], a[k])) return j; \
+            return less(a[i], a[k]) ? k : i; \
+        } \
+        if(less(a[k], a[j])) return j; \
+        return less(a[k], a[i]) ? k : i; \
+    } \
+    \
+    static void name##_introsort_internal(T *a, size_t n, int depth) { \
+        while(n > PL_SORT_INSERTION_THRESHOLD) { \
+            if(depth-- == 0) { \
+                name##_heapsort_internal(a, n); \
+                return; \
+            } \
+            size_t m; \
+            if(n > PL_SORT_NINTHER_THRESHOLD) { \
+                size_t s = n / 8; \
+                size_t h = n / 2; \
+                m = name##_median3_internal(a, \
+                    name##_median3_internal(a, 0, s, 2 * s), \
+                    name##_median3_internal(a, h - s, h, h + s), \
+                    name##_median3_internal(a, n - 1 - 2 * s, n - 1 - s, n - 1)); \
+            } \
+            else m = name##_median3_internal(a, 0, n / 2, n - 1); \
+            T p = a[m]; \
+            a[m] = a[0]; \
+            a[0] = p; \
+            size_t i = 0; \
+            size_t j = n; \
+            for(;;) { \
+                do i++; while(i < n && less(a[i], p)); \
+                do j--; while(less(p, a[j])); \
+                if(i >= j) break; \
+                T tmp = a[i]; \
+                a[i] = a[j]; \
+                a[j] = tmp; \
+            } \
+            a[0] = a[j]; \
+            a[j] = p; \
+            if(j < n - j - 1) { \
+                name##_introsort_internal(a, j, depth); \
+                a += j + 1; \
+                n -= j + 1; \
+            } \
+            else { \
+                name##_introsort_internal(a + j + 1, n - j - 1, depth); \
+                n = j; \
+            } \
+        } \
+        name##_insertion_internal(a, n); \
+    } \
+    \
+    static inline void name(T *base, size_t num) { \
+        if(num < 2) return; \
+        name##_introsort_internal(base, num, _pl_sort_depth_limit_internal(num)); \
+    }
+
 #if defined(PLATO_IMPLEMENTATION) || defined(PLATO_SORT_IMPLEMENTATION)
 
+// Moves eight bytes at a time; memcpy keeps unaligned elements safe and
+// compiles down to plain word loads and stores
 static void _pl_sort_swap_internal(void *a, void *b, size_t size) {
     unsigned char *pa = (unsigned char*)a;
-    unsigned char *pb = (unsigned char*)b; 
-    unsigned char *tmp;
+    unsigned char *pb = (unsigned char*)b;
+    while(size >= sizeof(uint64_t)) {
+        uint64_t wa, wb;
+        memcpy(&wa, pa, sizeof(uint64_t));
+        memcpy(&wb, pb, sizeof(uint64_t));
+        memcpy(pa, &wb, sizeof(uint64_t));
+        memcpy(pb, &wa, sizeof(uint64_t));
+        pa += sizeof(uint64_t);
+        pb += sizeof(uint64_t);
+        size -= sizeof(uint64_t);
+    }
+    unsigned char tmp;
     while(size--) {
         tmp = *pa;
         *pa++ = *pb;
@@ -24,40 +230,807 @@ static void _pl_sort_swap_internal(void *a, void *b, size_t size) {
     }
 }
 
-static void *_pl_sort_partition_internal(
-    void *base, 
-    size_t num, 
-    size_t size, 
-    int (*cmp)(const void*, const void*, void*), 
-    void *arg
-) {
-    unsigned char *arr = (unsigned char*)base;
-    void *pivot = arr + (num - 1) * size;
+typedef struct _pl_sort_ctx_s {
+    size_t size;
+    int (*cmp)(const void*, const void*, void*);
+    void *arg;
+} _pl_sort_ctx_t;
+
+static inline int _pl_sort_less_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t i, size_t j) {
+    return ctx->cmp(arr + i * ctx->size, arr + j * ctx->size, ctx->arg) < 0;
+}
+
+static void _pl_sort_insertion_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t num) {
+    for(size_t i = 1; i < num; i++) {
+        for(size_t j = i; j > 0 && _pl_sort_less_internal(ctx, arr, j, j - 1); j--) {
+            _pl_sort_swap_internal(arr + j * ctx->size, arr + (j - 1) * ctx->size, ctx->size);
+        }
+    }
+}
+
+static void _pl_sort_sift_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t root, size_t num) {
+    for(;;) {
+        size_t child = 2 * root + 1;
+        if(child >= num) return;
+        if(child + 1 < num && _pl_sort_less_internal(ctx, arr, child, child + 1)) child++;
+        if(!_pl_sort_less_internal(ctx, arr, root, child)) return;
+        _pl_sort_swap_internal(arr + root * ctx->size, arr + child * ctx->size, ctx->size);
+        root = child;
+    }
+}
+
+static void _pl_sort_heapsort_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t num) {
+    for(size_t i = num / 2; i-- > 0;) _pl_sort_sift_internal(ctx, arr, i, num);
+    while(num > 1) {
+        num--;
+        _pl_sort_swap_internal(arr, arr + num * ctx->size, ctx->size);
+        _pl_sort_sift_internal(ctx, arr, 0, num);
+    }
+}
+
+static size_t _pl_sort_median3_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t i, size_t j, size_t k) {
+    if(_pl_sort_less_internal(ctx, arr, i, j)) {
+        if(_pl_sort_less_internal(ctx, arr, j, k)) return j;
+        return _pl_sort_less_internal(ctx, arr, i, k) ? k : i;
+    }
+    if(_pl_sort_less_internal(ctx, arr, k, j)) return j;
+    return _pl_sort_less_internal(ctx, arr, k, i) ? k : i;
+}
+
+// Moves a median-of-3 (or ninther) pivot to the front and partitions around
+// it Hoare style, so runs of equal keys split evenly. Returns the pivot's
+// final index.
+static size_t _pl_sort_partition_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t num) {
+    size_t size = ctx->size;
+    size_t m;
+    if(num > PL_SORT_NINTHER_THRESHOLD) {
+        size_t s = num / 8;
+        size_t h = num / 2;
+        m = _pl_sort_median3_internal(ctx, arr,
+            _pl_sort_median3_internal(ctx, arr, 0, s, 2 * s),
+            _pl_sort_median3_internal(ctx, arr, h - s, h, h + s),
+            _pl_sort_median3_internal(ctx, arr, num - 1 - 2 * s, num - 1 - s, num - 1));
+    }
+    else m = _pl_sort_median3_internal(ctx, arr, 0, num / 2, num - 1);
+    if(m != 0) _pl_sort_swap_internal(arr, arr + m * size, size);
+
     size_t i = 0;
+    size_t j = num;
+    for(;;) {
+        do i++; while(i < num && _pl_sort_less_internal(ctx, arr, i, 0));
+        do j--; while(_pl_sort_less_internal(ctx, arr, 0, j));
+        if(i >= j) break;
+        _pl_sort_swap_internal(arr + i * size, arr + j * size, size);
+    }
+    if(j != 0) _pl_sort_swap_internal(arr, arr + j * size, size);
+    return j;
+}
 
-    for(size_t j = 0; j < num - 1; j++) {
-        if (cmp(arr + j * size, pivot, arg) < 0) {
-            _pl_sort_swap_internal(arr + i * size, arr + j * size, size);
-            i++;
+// Recurses into the smaller side and loops on the larger one, so the stack
+// stays O(log n) deep; 'depth' running out means the pivots are degenerate
+static void _pl_sort_introsort_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, size_t num, int depth) {
+    while(num > PL_SORT_INSERTION_THRESHOLD) {
+        if(depth-- == 0) {
+            _pl_sort_heapsort_internal(ctx, arr, num);
+            return;
+        }
+        size_t p = _pl_sort_partition_internal(ctx, arr, num);
+        if(p < num - p - 1) {
+            _pl_sort_introsort_internal(ctx, arr, p, depth);
+            arr += (p + 1) * ctx->size;
+            num -= p + 1;
+        }
+        else {
+            _pl_sort_introsort_internal(ctx, arr + (p + 1) * ctx->size, num - p - 1, depth);
+            num = p;
         }
     }
-    _pl_sort_swap_internal(arr + i * size, pivot, size);
-    return arr + i * size;
+    _pl_sort_insertion_internal(ctx, arr, num);
 }
 
 void pl_qsort_r(
-    void *base, 
-    size_t num, 
-    size_t size, 
-    int (*cmp)(const void *, const void *, void *), 
+    void *base,
+    size_t num,
+    size_t size,
+    int (*cmp)(const void *, const void *, void *),
+    void *arg
+) {
+    if(num < 2 || size == 0) return;
+    _pl_sort_ctx_t ctx = {size, cmp, arg};
+    _pl_sort_introsort_internal(&ctx, (unsigned char*)base, num, _pl_sort_depth_limit_internal(num));
+}
+
+#if defined(PL_SORT_AVX2)
+    #define _PL_SORT_LANES 8
+#elif defined(PL_SORT_SSE)
+    #define _PL_SORT_LANES 4
+#endif
+
+#if defined(_PL_SORT_LANES)
+#if defined(PL_SORT_AVX2)
+typedef __m256i _pl_sort_vec_t;
+#define _PL_SORT_VLOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define _PL_SORT_VSTORE(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define _PL_SORT_VSET1(x) _mm256_set1_epi32(x)
+#define _PL_SORT_VCMPGT(a, b) _mm256_cmpgt_epi32((a), (b))
+#define _PL_SORT_VCMPEQ(a, b) _mm256_cmpeq_epi32((a), (b))
+#define _PL_SORT_VAND(a, b) _mm256_and_si256((a), (b))
+#define _PL_SORT_VXOR(a, b) _mm256_xor_si256((a), (b))
+#define _PL_SORT_VBLEND(a, b, mask) _mm256_blendv_epi8((a), (b), (mask))
+#define _PL_SORT_VLANES(base) _mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))
+
+// Lane l of the result holds lane l ^ j of 'v'
+static inline __m256i _pl_sort_partner_internal(__m256i v, int j) {
+    if(j == 4) return _mm256_permute2x128_si256(v, v, 0x01);
+    if(j == 2) return _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#else
+typedef __m128i _pl_sort_vec_t;
+#define _PL_SORT_VLOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define _PL_SORT_VSTORE(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define _PL_SORT_VSET1(x) _mm_set1_epi32(x)
+#define _PL_SORT_VCMPGT(a, b) _mm_cmpgt_epi32((a), (b))
+#define _PL_SORT_VCMPEQ(a, b) _mm_cmpeq_epi32((a), (b))
+#define _PL_SORT_VAND(a, b) _mm_and_si128((a), (b))
+#define _PL_SORT_VXOR(a, b) _mm_xor_si128((a), (b))
+#define _PL_SORT_VBLEND(a, b, mask) _mm_or_si128(_mm_and_si128((mask), (b)), _mm_andnot_si128((mask), (a)))
+#define _PL_SORT_VLANES(base) _mm_add_epi32(_mm_set1_epi32(base), _mm_setr_epi32(0, 1, 2, 3))
+
+static inline __m128i _pl_sort_partner_internal(__m128i v, int j) {
+    if(j == 2) return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+}
+#endif
+#endif
+
+// Bitonic sort of 'n' (a power of two, 8 to 64) signed keys, moving
+// 'values' along when given. Stage (k, j) compare-exchanges element i with
+// i ^ j, ascending where i & k is clear. Distances of a whole vector or more
+// pair up separate registers; shorter ones pair lanes within a register.
+static void _pl_sort_bitonic_internal(int32_t *keys, uint32_t *values, int n) {
+    for(int k = 2; k <= n; k *= 2) {
+        for(int j = k / 2; j > 0; j /= 2) {
+#if defined(_PL_SORT_LANES)
+            if(j >= _PL_SORT_LANES) {
+                for(int i = 0; i < n; i += _PL_SORT_LANES) {
+                    if(i & j) continue;
+                    _pl_sort_vec_t a = _PL_SORT_VLOAD(keys + i);
+                    _pl_sort_vec_t b = _PL_SORT_VLOAD(keys + i + j);
+                    _pl_sort_vec_t swap = (i & k) ? _PL_SORT_VCMPGT(b, a) : _PL_SORT_VCMPGT(a, b);
+                    _PL_SORT_VSTORE(keys + i, _PL_SORT_VBLEND(a, b, swap));
+                    _PL_SORT_VSTORE(keys + i + j, _PL_SORT_VBLEND(b, a, swap));
+                    if(values) {
+                        _pl_sort_vec_t va = _PL_SORT_VLOAD(values + i);
+                        _pl_sort_vec_t vb = _PL_SORT_VLOAD(values + i + j);
+                        _PL_SORT_VSTORE(values + i, _PL_SORT_VBLEND(va, vb, swap));
+                        _PL_SORT_VSTORE(values + i + j, _PL_SORT_VBLEND(vb, va, swap));
+                    }
+                }
+                continue;
+            }
+            _pl_sort_vec_t zero = _PL_SORT_VSET1(0);
+            for(int i = 0; i < n; i += _PL_SORT_LANES) {
+                // Lanes that want the larger key: upper lanes of ascending
+                // pairs and lower lanes of descending ones
+                _pl_sort_vec_t lanes = _PL_SORT_VLANES(i);
+                _pl_sort_vec_t lower = _PL_SORT_VCMPEQ(_PL_SORT_VAND(lanes, _PL_SORT_VSET1(j)), zero);
+                _pl_sort_vec_t ascending = _PL_SORT_VCMPEQ(_PL_SORT_VAND(lanes, _PL_SORT_VSET1(k)), zero);
+                _pl_sort_vec_t wants_max = _PL_SORT_VXOR(lower, ascending);
+
+                _pl_sort_vec_t a = _PL_SORT_VLOAD(keys + i);
+                _pl_sort_vec_t p = _pl_sort_partner_internal(a, j);
+                _pl_sort_vec_t take = _PL_SORT_VBLEND(_PL_SORT_VCMPGT(a, p), _PL_SORT_VCMPGT(p, a), wants_max);
+                _PL_SORT_VSTORE(keys + i, _PL_SORT_VBLEND(a, p, take));
+                if(values) {
+                    _pl_sort_vec_t v = _PL_SORT_VLOAD(values + i);
+                    _PL_SORT_VSTORE(values + i, _PL_SORT_VBLEND(v, _pl_sort_partner_internal(v, j), take));
+                }
+            }
+#else
+            for(int i = 0; i < n; i++) {
+                int l = i ^ j;
+                if(l < i) continue;
+                int swap = (i & k) ? keys[i] < keys[l] : keys[i] > keys[l];
+                if(swap) {
+                    int32_t t = keys[i]; keys[i] = keys[l]; keys[l] = t;
+                    if(values) {
+                        uint32_t v = values[i]; values[i] = values[l]; values[l] = v;
+                    }
+                }
+            }
+#endif
+        }
+    }
+}
+
+// Maps each key type to a signed key with the same order. Floats keep
+// positive bit patterns and flip the magnitude bits of negative ones.
+static inline int32_t _pl_sort_key_f32_internal(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u ^= (uint32_t)(-(int32_t)(u >> 31)) & 0x7fffffffu;
+    return (int32_t)u;
+}
+
+static inline float _pl_sort_f32_key_internal(int32_t key) {
+    uint32_t u = (uint32_t)key;
+    u ^= (uint32_t)(-(int32_t)(u >> 31)) & 0x7fffffffu;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+#define _PL_SORT_KEY_F32 0
+#define _PL_SORT_KEY_I32 1
+#define _PL_SORT_KEY_U32 2
+
+static inline int32_t _pl_sort_load_key_internal(const void *keys, size_t i, int type) {
+    if(type == _PL_SORT_KEY_F32) return _pl_sort_key_f32_internal(((const float*)keys)[i]);
+    if(type == _PL_SORT_KEY_I32) return ((const int32_t*)keys)[i];
+    return (int32_t)(((const uint32_t*)keys)[i] ^ 0x80000000u);
+}
+
+// Copies up to PL_SORT_NETWORK_MAX keys into a padded power-of-two buffer,
+// sorts it and copies the first 'num' back. Padding uses INT32_MAX, so real
+// keys mapping to INT32_MAX may have traded values with padding; those keys
+// all sort last, and their values are put back in input order.
+static int _pl_sort_network_internal(void *keys, uint32_t *values, size_t num, int type) {
+    if(num > PL_SORT_NETWORK_MAX) return 1;
+    if(num < 2) return 0;
+
+    int32_t k[PL_SORT_NETWORK_MAX];
+    uint32_t v[PL_SORT_NETWORK_MAX];
+    int n = 8;
+    while((size_t)n < num) n *= 2;
+
+    size_t max_count = 0;
+    for(size_t i = 0; i < num; i++) {
+        k[i] = _pl_sort_load_key_internal(keys, i, type);
+        max_count += k[i] == INT32_MAX;
+    }
+    for(int i = (int)num; i < n; i++) k[i] = INT32_MAX;
+    if(values) memcpy(v, values, num * sizeof(uint32_t));
+
+    _pl_sort_bitonic_internal(k, values ? v : NULL, n);
+
+    if(values) {
+        if(max_count > 0) {
+            size_t out = num - max_count;
+            for(size_t i = 0; out < num; i++) {
+                if(_pl_sort_load_key_internal(keys, i, type) == INT32_MAX) v[out++] = values[i];
+            }
+        }
+        memcpy(values, v, num * sizeof(uint32_t));
+    }
+    for(size_t i = 0; i < num; i++) {
+        if(type == _PL_SORT_KEY_F32) ((float*)keys)[i] = _pl_sort_f32_key_internal(k[i]);
+        else if(type == _PL_SORT_KEY_I32) ((int32_t*)keys)[i] = k[i];
+        else ((uint32_t*)keys)[i] = (uint32_t)k[i] ^ 0x80000000u;
+    }
+    return 0;
+}
+
+int pl_sort_network_f32(float *keys, size_t num) {
+    return _pl_sort_network_internal(keys, NULL, num, _PL_SORT_KEY_F32);
+}
+
+int pl_sort_network_i32(int32_t *keys, size_t num) {
+    return _pl_sort_network_internal(keys, NULL, num, _PL_SORT_KEY_I32);
+}
+
+int pl_sort_network_u32(uint32_t *keys, size_t num) {
+    return _pl_sort_network_internal(keys, NULL, num, _PL_SORT_KEY_U32);
+}
+
+int pl_sort_network_f32_kv(float *keys, uint32_t *values, size_t num) {
+    return _pl_sort_network_internal(keys, values, num, _PL_SORT_KEY_F32);
+}
+
+int pl_sort_network_i32_kv(int32_t *keys, uint32_t *values, size_t num) {
+    return _pl_sort_network_internal(keys, values, num, _PL_SORT_KEY_I32);
+}
+
+int pl_sort_network_u32_kv(uint32_t *keys, uint32_t *values, size_t num) {
+    return _pl_sort_network_internal(keys, values, num, _PL_SORT_KEY_U32);
+}
+
+#define _PL_RADIX_SORT_BUCKETS (1 << PL_RADIX_SORT_BITS)
+#define _PL_RADIX_SORT_MASK (_PL_RADIX_SORT_BUCKETS - 1)
+
+static void _pl_radix_insertion_u32_internal(uint32_t *keys, uint32_t *values, size_t num) {
+    for(size_t i = 1; i < num; i++) {
+        uint32_t k = keys[i];
+        uint32_t v = values ? values[i] : 0;
+        size_t j = i;
+        while(j > 0 && k < keys[j - 1]) {
+            keys[j] = keys[j - 1];
+            if(values) values[j] = values[j - 1];
+            j--;
+        }
+        keys[j] = k;
+        if(values) values[j] = v;
+    }
+}
+
+static void _pl_radix_insertion_u64_internal(uint64_t *keys, uint32_t *values, size_t num) {
+    for(size_t i = 1; i < num; i++) {
+        uint64_t k = keys[i];
+        uint32_t v = values ? values[i] : 0;
+        size_t j = i;
+        while(j > 0 && k < keys[j - 1]) {
+            keys[j] = keys[j - 1];
+            if(values) values[j] = values[j - 1];
+            j--;
+        }
+        keys[j] = k;
+        if(values) values[j] = v;
+    }
+}
+
+// Turns prefix counts into bucket offsets. Returns 1 when every key shares
+// the same digit, in which case the pass would not move anything.
+static int _pl_radix_offsets_internal(uint32_t *counts, size_t num) {
+    uint32_t sum = 0;
+    for(int d = 0; d < _PL_RADIX_SORT_BUCKETS; d++) {
+        if(counts[d] == num) return 1;
+        uint32_t c = counts[d];
+        counts[d] = sum;
+        sum += c;
+    }
+    return 0;
+}
+
+// 'values' and 'value_scratch' may be NULL for a keys-only sort
+static void _pl_radix_u32_internal(uint32_t *keys, uint32_t *values, size_t num, uint32_t *key_scratch, uint32_t *value_scratch) {
+    // The network is not stable, which only matters with a payload
+    if(!values && num <= PL_SORT_NETWORK_MAX) {
+        _pl_sort_network_internal(keys, NULL, num, _PL_SORT_KEY_U32);
+        return;
+    }
+    if(num < PL_RADIX_SORT_SMALL) {
+        _pl_radix_insertion_u32_internal(keys, values, num);
+        return;
+    }
+
+    // All three histograms come from a single read of the keys
+    enum { passes = (32 + PL_RADIX_SORT_BITS - 1) / PL_RADIX_SORT_BITS };
+    uint32_t counts[passes][_PL_RADIX_SORT_BUCKETS];
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < num; i++) {
+        uint32_t k = keys[i];
+        for(int p = 0; p < passes; p++) counts[p][(k >> (p * PL_RADIX_SORT_BITS)) & _PL_RADIX_SORT_MASK]++;
+    }
+
+    uint32_t *src = keys, *dst = key_scratch;
+    uint32_t *vsrc = values, *vdst = value_scratch;
+    for(int p = 0; p < passes; p++) {
+        if(_pl_radix_offsets_internal(counts[p], num)) continue;
+        uint32_t *offsets = counts[p];
+        int shift = p * PL_RADIX_SORT_BITS;
+        if(vsrc) {
+            for(size_t i = 0; i < num; i++) {
+                uint32_t o = offsets[(src[i] >> shift) & _PL_RADIX_SORT_MASK]++;
+                dst[o] = src[i];
+                vdst[o] = vsrc[i];
+            }
+            uint32_t *vt = vsrc; vsrc = vdst; vdst = vt;
+        }
+        else {
+            for(size_t i = 0; i < num; i++) dst[offsets[(src[i] >> shift) & _PL_RADIX_SORT_MASK]++] = src[i];
+        }
+        uint32_t *t = src; src = dst; dst = t;
+    }
+
+    if(src != keys) {
+        memcpy(keys, src, num * sizeof(uint32_t));
+        if(vsrc) memcpy(values, vsrc, num * sizeof(uint32_t));
+    }
+}
+
+static void _pl_radix_u64_internal(uint64_t *keys, uint32_t *values, size_t num, uint64_t *key_scratch, uint32_t *value_scratch) {
+    if(num < PL_RADIX_SORT_SMALL) {
+        _pl_radix_insertion_u64_internal(keys, values, num);
+        return;
+    }
+
+    enum { passes = (64 + PL_RADIX_SORT_BITS - 1) / PL_RADIX_SORT_BITS };
+    uint32_t counts[passes][_PL_RADIX_SORT_BUCKETS];
+    memset(counts, 0, sizeof(counts));
+    for(size_t i = 0; i < num; i++) {
+        uint64_t k = keys[i];
+        for(int p = 0; p < passes; p++) counts[p][(k >> (p * PL_RADIX_SORT_BITS)) & _PL_RADIX_SORT_MASK]++;
+    }
+
+    uint64_t *src = keys, *dst = key_scratch;
+    uint32_t *vsrc = values, *vdst = value_scratch;
+    for(int p = 0; p < passes; p++) {
+        if(_pl_radix_offsets_internal(counts[p], num)) continue;
+        uint32_t *offsets = counts[p];
+        int shift = p * PL_RADIX_SORT_BITS;
+        if(vsrc) {
+            for(size_t i = 0; i < num; i++) {
+                uint32_t o = offsets[(src[i] >> shift) & _PL_RADIX_SORT_MASK]++;
+                dst[o] = src[i];
+                vdst[o] = vsrc[i];
+            }
+            uint32_t *vt = vsrc; vsrc = vdst; vdst = vt;
+        }
+        else {
+            for(size_t i = 0; i < num; i++) dst[offsets[(src[i] >> shift) & _PL_RADIX_SORT_MASK]++] = src[i];
+        }
+        uint64_t *t = src; src = dst; dst = t;
+    }
+
+    if(src != keys) {
+        memcpy(keys, src, num * sizeof(uint64_t));
+        if(vsrc) memcpy(values, vsrc, num * sizeof(uint32_t));
+    }
+}
+
+// Maps float bits to unsigned integers with the same ordering: negative
+// values have all bits flipped, positive ones just the sign bit
+static void _pl_radix_f32_to_u32_internal(float *keys, size_t num) {
+    for(size_t i = 0; i < num; i++) {
+        uint32_t u;
+        memcpy(&u, &keys[i], sizeof(u));
+        u ^= (uint32_t)(-(int32_t)(u >> 31)) | 0x80000000u;
+        memcpy(&keys[i], &u, sizeof(u));
+    }
+}
+
+static void _pl_radix_u32_to_f32_internal(float *keys, size_t num) {
+    for(size_t i = 0; i < num; i++) {
+        uint32_t u;
+        memcpy(&u, &keys[i], sizeof(u));
+        u ^= ((u >> 31) - 1) | 0x80000000u;
+        memcpy(&keys[i], &u, sizeof(u));
+    }
+}
+
+int pl_radix_sort_u32(uint32_t *keys, size_t num, uint32_t *scratch) {
+    if(!scratch || num > UINT32_MAX) return 1;
+    _pl_radix_u32_internal(keys, NULL, num, scratch, NULL);
+    return 0;
+}
+
+int pl_radix_sort_u64(uint64_t *keys, size_t num, uint64_t *scratch) {
+    if(!scratch || num > UINT32_MAX) return 1;
+    _pl_radix_u64_internal(keys, NULL, num, scratch, NULL);
+    return 0;
+}
+
+int pl_radix_sort_f32(float *keys, size_t num, float *scratch) {
+    if(!scratch || num > UINT32_MAX) return 1;
+    _pl_radix_f32_to_u32_internal(keys, num);
+    _pl_radix_u32_internal((uint32_t*)keys, NULL, num, (uint32_t*)scratch, NULL);
+    _pl_radix_u32_to_f32_internal(keys, num);
+    return 0;
+}
+
+int pl_radix_sort_u32_kv(uint32_t *keys, uint32_t *values, size_t num, uint32_t *key_scratch, uint32_t *value_scratch) {
+    if(!key_scratch || !value_scratch || num > UINT32_MAX) return 1;
+    _pl_radix_u32_internal(keys, values, num, key_scratch, value_scratch);
+    return 0;
+}
+
+int pl_radix_sort_u64_kv(uint64_t *keys, uint32_t *values, size_t num, uint64_t *key_scratch, uint32_t *value_scratch) {
+    if(!key_scratch || !value_scratch || num > UINT32_MAX) return 1;
+    _pl_radix_u64_internal(keys, values, num, key_scratch, value_scratch);
+    return 0;
+}
+
+int pl_radix_sort_f32_kv(float *keys, uint32_t *values, size_t num, float *key_scratch, uint32_t *value_scratch) {
+    if(!key_scratch || !value_scratch || num > UINT32_MAX) return 1;
+    _pl_radix_f32_to_u32_internal(keys, num);
+    _pl_radix_u32_internal((uint32_t*)keys, values, num, (uint32_t*)key_scratch, value_scratch);
+    _pl_radix_u32_to_f32_internal(keys, num);
+    return 0;
+}
+
+// Stable bottom-up merge sort through 'scratch', which holds 'num' elements
+static void _pl_sort_stable_internal(_pl_sort_ctx_t *ctx, unsigned char *arr, unsigned char *scratch, size_t num) {
+    size_t size = ctx->size;
+    for(size_t i = 0; i < num; i += PL_SORT_INSERTION_THRESHOLD) {
+        size_t n = num - i < PL_SORT_INSERTION_THRESHOLD ? num - i : PL_SORT_INSERTION_THRESHOLD;
+        _pl_sort_insertion_internal(ctx, arr + i * size, n);
+    }
+
+    unsigned char *src = arr, *dst = scratch;
+    for(size_t width = PL_SORT_INSERTION_THRESHOLD; width < num; width *= 2) {
+        for(size_t lo = 0; lo < num; lo += 2 * width) {
+            size_t mid = lo + width < num ? lo + width : num;
+            size_t hi = lo + 2 * width < num ? lo + 2 * width : num;
+            size_t i = lo, j = mid, k = lo;
+            while(i < mid && j < hi) {
+                // Ties take the left run first
+                if(ctx->cmp(src + j * size, src + i * size, ctx->arg) < 0) memcpy(dst + k++ * size, src + j++ * size, size);
+                else memcpy(dst + k++ * size, src + i++ * size, size);
+            }
+            memcpy(dst + k * size, src + i * size, (mid - i) * size);
+            k += mid - i;
+            memcpy(dst + k * size, src + j * size, (hi - j) * size);
+        }
+        unsigned char *t = src; src = dst; dst = t;
+    }
+    if(src != arr) memcpy(arr, src, num * size);
+}
+
+// Orders elements of the merge input by value, then by run, then by position,
+// which is the order a stable merge emits them in
+typedef struct _pl_merge_sample_s {
+    size_t run;
+    size_t pos;
+} _pl_merge_sample_t;
+
+typedef struct _pl_merge_s {
+    _pl_sort_ctx_t ctx;
+    const unsigned char *src;
+    unsigned char *dst;
+    const size_t *run_offsets;
+    size_t run_count;
+    size_t part_count;
+    _pl_merge_sample_t *samples;
+    size_t sample_count;
+    size_t *splits;
+    size_t *cursors;
+    size_t *trees;
+} _pl_merge_t;
+
+static int _pl_merge_sample_cmp_internal(const void *a, const void *b, void *arg) {
+    _pl_merge_t *merge = (_pl_merge_t*)arg;
+    const _pl_merge_sample_t *sa = (const _pl_merge_sample_t*)a;
+    const _pl_merge_sample_t *sb = (const _pl_merge_sample_t*)b;
+    size_t size = merge->ctx.size;
+    int c = merge->ctx.cmp(merge->src + sa->pos * size, merge->src + sb->pos * size, merge->ctx.arg);
+    if(c != 0) return c;
+    if(sa->run != sb->run) return sa->run < sb->run ? -1 : 1;
+    return (sa->pos > sb->pos) - (sa->pos < sb->pos);
+}
+
+// First position in [lo, hi) whose element orders after 'value'; with
+// 'inclusive' set, equal elements count as before it
+static size_t _pl_merge_bound_internal(_pl_merge_t *merge, size_t lo, size_t hi, const void *value, int inclusive) {
+    size_t size = merge->ctx.size;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = merge->ctx.cmp(merge->src + mid * size, value, merge->ctx.arg);
+        if(c < 0 || (inclusive && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Row b of 'splits' holds, per run, where output part b starts. Rows 0 and
+// part_count are the run bounds; the rest are found by binary search for
+// the part's splitter sample, which keeps the cut consistent with stability.
+static void _pl_merge_splits_internal(void *arg, size_t begin, size_t end) {
+    _pl_merge_t *merge = (_pl_merge_t*)arg;
+    size_t k = merge->run_count;
+    for(size_t b = begin; b < end; b++) {
+        size_t *row = merge->splits + b * k;
+        if(b == 0 || b == merge->part_count) {
+            for(size_t j = 0; j < k; j++) row[j] = merge->run_offsets[j + (b ? 1 : 0)];
+            continue;
+        }
+        _pl_merge_sample_t *s = &merge->samples[b * merge->sample_count / merge->part_count];
+        const void *value = merge->src + s->pos * merge->ctx.size;
+        for(size_t j = 0; j < k; j++) {
+            size_t lo = merge->run_offsets[j], hi = merge->run_offsets[j + 1];
+            if(j == s->run) row[j] = s->pos;
+            else row[j] = _pl_merge_bound_internal(merge, lo, hi, value, j < s->run);
+        }
+    }
+}
+
+// Exhausted runs order after everything; ties go to the earlier run
+static int _pl_merge_less_internal(_pl_merge_t *merge, size_t *cursors, size_t *ends, size_t a, size_t b) {
+    if(a >= merge->run_count || cursors[a] == ends[a]) return 0;
+    if(b >= merge->run_count || cursors[b] == ends[b]) return 1;
+    size_t size = merge->ctx.size;
+    int c = merge->ctx.cmp(merge->src + cursors[a] * size, merge->src + cursors[b] * size, merge->ctx.arg);
+    return c < 0 || (c == 0 && a < b);
+}
+
+// k-way merge of one output part through a loser tree over the runs, which
+// costs log2(k) comparisons per element
+static void _pl_merge_parts_internal(void *arg, size_t begin, size_t end) {
+    _pl_merge_t *merge = (_pl_merge_t*)arg;
+    size_t k = merge->run_count;
+    size_t size = merge->ctx.size;
+    size_t leaves = 1;
+    while(leaves < k) leaves *= 2;
+
+    for(size_t b = begin; b < end; b++) {
+        size_t *lo = merge->splits + b * k;
+        size_t *hi = merge->splits + (b + 1) * k;
+        size_t *cursors = merge->cursors + b * k;
+        size_t *tree = merge->trees + b * 4 * k;
+        size_t *winners = tree + leaves;
+
+        size_t out = 0, count = 0;
+        for(size_t j = 0; j < k; j++) {
+            out += lo[j] - merge->run_offsets[j];
+            count += hi[j] - lo[j];
+            cursors[j] = lo[j];
+        }
+        unsigned char *dst = merge->dst + out * size;
+
+        // Node n has children 2n and 2n + 1, leaf nodes sit at leaves + run
+        for(size_t n = leaves - 1; n >= 1; n--) {
+            size_t l = 2 * n >= leaves ? 2 * n - leaves : winners[2 * n];
+            size_t r = 2 * n + 1 >= leaves ? 2 * n + 1 - leaves : winners[2 * n + 1];
+            int right_wins = _pl_merge_less_internal(merge, cursors, hi, r, l);
+            winners[n] = right_wins ? r : l;
+            tree[n] = right_wins ? l : r;
+        }
+        size_t winner = leaves > 1 ? winners[1] : 0;
+
+        while(count-- > 0) {
+            memcpy(dst, merge->src + cursors[winner] * size, size);
+            dst += size;
+            cursors[winner]++;
+            for(size_t n = (leaves + winner) / 2; n >= 1; n /= 2) {
+                if(_pl_merge_less_internal(merge, cursors, hi, tree[n], winner)) {
+                    size_t t = tree[n];
+                    tree[n] = winner;
+                    winner = t;
+                }
+            }
+        }
+    }
+}
+
+int pl_parallel_merge(
+    pl_jobs_t *jobs,
+    const void *src,
+    void *dst,
+    size_t size,
+    const size_t *run_offsets,
+    size_t run_count,
+    int (*cmp)(const void *, const void *, void *),
     void *arg
 ) {
-    if(num < 2) return;
-    unsigned char *arr = (unsigned char*)base;
-    void *p = _pl_sort_partition_internal(arr, num, size, cmp, arg);
-    size_t pivot_index = (p - (void *)arr) / size;
-    pl_qsort_r(arr, pivot_index, size, cmp, arg);
-    pl_qsort_r(arr + (pivot_index + 1) * size, num - pivot_index - 1, size, cmp, arg);
+    if(!src || !dst || !run_offsets || !cmp || size == 0) return 1;
+    if(run_count == 0) return 0;
+
+    size_t total = run_offsets[run_count] - run_offsets[0];
+    size_t parts = total / PL_PARALLEL_SORT_THRESHOLD;
+    if(parts < 1) parts = 1;
+    if(parts > PL_PARALLEL_SORT_MAX_PARTS) parts = PL_PARALLEL_SORT_MAX_PARTS;
+
+    _pl_merge_t merge = {
+        {size, cmp, arg}, (const unsigned char*)src, (unsigned char*)dst,
+        run_offsets, run_count, parts, NULL, 0, NULL, NULL, NULL
+    };
+
+    // Regular sampling: parts - 1 evenly spaced elements from every run
+    merge.samples = (_pl_merge_sample_t*)malloc(sizeof(_pl_merge_sample_t) * (run_count * (parts - 1) + 1));
+    merge.splits = (size_t*)malloc(sizeof(size_t) * (parts + 1) * run_count);
+    merge.cursors = (size_t*)malloc(sizeof(size_t) * parts * run_count * 5);
+    if(!merge.samples || !merge.splits || !merge.cursors) {
+        free(merge.samples);
+        free(merge.splits);
+        free(merge.cursors);
+        return 1;
+    }
+    merge.trees = merge.cursors + parts * run_count;
+
+    for(size_t j = 0; j < run_count; j++) {
+        size_t lo = run_offsets[j], len = run_offsets[j + 1] - lo;
+        for(size_t t = 1; t < parts && len > 0; t++) {
+            size_t pos = lo + len * t / parts;
+            if(merge.sample_count > 0 && merge.samples[merge.sample_count - 1].run == j && merge.samples[merge.sample_count - 1].pos == pos) continue;
+            merge.samples[merge.sample_count].run = j;
+            merge.samples[merge.sample_count].pos = pos;
+            merge.sample_count++;
+        }
+    }
+    pl_qsort_r(merge.samples, merge.sample_count, sizeof(_pl_merge_sample_t), _pl_merge_sample_cmp_internal, &merge);
+    if(merge.sample_count == 0) merge.part_count = parts = 1;
+
+    pl_jobs_parallel_for(jobs, parts + 1, 1, _pl_merge_splits_internal, &merge);
+    pl_jobs_parallel_for(jobs, parts, 1, _pl_merge_parts_internal, &merge);
+
+    free(merge.samples);
+    free(merge.splits);
+    free(merge.cursors);
+    return 0;
+}
+
+typedef struct _pl_parallel_sort_s {
+    _pl_sort_ctx_t ctx;
+    unsigned char *arr;
+    unsigned char *scratch;
+    size_t num;
+    size_t chunk;
+    int flags;
+} _pl_parallel_sort_t;
+
+static void _pl_parallel_sort_chunks_internal(void *arg, size_t begin, size_t end) {
+    _pl_parallel_sort_t *sort = (_pl_parallel_sort_t*)arg;
+    size_t size = sort->ctx.size;
+    for(size_t c = begin; c < end; c++) {
+        size_t lo = c * sort->chunk;
+        size_t n = sort->num - lo < sort->chunk ? sort->num - lo : sort->chunk;
+        if(sort->flags & PL_SORT_STABLE) {
+            _pl_sort_stable_internal(&sort->ctx, sort->arr + lo * size, sort->scratch + lo * size, n);
+        }
+        else if(n > 1) {
+            _pl_sort_introsort_internal(&sort->ctx, sort->arr + lo * size, n, _pl_sort_depth_limit_internal(n));
+        }
+    }
+}
+
+static void _pl_parallel_sort_copy_internal(void *arg, size_t begin, size_t end) {
+    _pl_parallel_sort_t *sort = (_pl_parallel_sort_t*)arg;
+    size_t size = sort->ctx.size;
+    memcpy(sort->arr + begin * size, sort->scratch + begin * size, (end - begin) * size);
+}
+
+// Sorts fixed-size chunks on the job system and merges them with
+// pl_parallel_merge. The chunking depends only on 'num', never on the thread
+// count, so the output is the same on every machine; with PL_SORT_STABLE
+// equal elements also keep their input order. Below
+// PL_PARALLEL_SORT_THRESHOLD elements, or without 'jobs', the sort runs on
+// the calling thread. Returns 0 on success, 1 on bad arguments or when the
+// num * size scratch buffer cannot be allocated for a stable sort.
+int pl_parallel_sort(
+    pl_jobs_t *jobs,
+    void *base,
+    size_t num,
+    size_t size,
+    int (*cmp)(const void *, const void *, void *),
+    void *arg,
+    int flags
+) {
+    if(!cmp || size == 0) return 1;
+    if(num < 2) return 0;
+    if(!base) return 1;
+
+    int stable = (flags & PL_SORT_STABLE) != 0;
+    if(!stable && (!jobs || num < PL_PARALLEL_SORT_THRESHOLD)) {
+        pl_qsort_r(base, num, size, cmp, arg);
+        return 0;
+    }
+
+    unsigned char *scratch = (unsigned char*)malloc(num * size);
+    if(!scratch) {
+        if(stable) return 1;
+        pl_qsort_r(base, num, size, cmp, arg);
+        return 0;
+    }
+
+    size_t chunk = (num + PL_PARALLEL_SORT_MAX_PARTS - 1) / PL_PARALLEL_SORT_MAX_PARTS;
+    if(chunk < PL_PARALLEL_SORT_THRESHOLD) chunk = PL_PARALLEL_SORT_THRESHOLD;
+    size_t chunk_count = (num + chunk - 1) / chunk;
+    if(!jobs) chunk_count = 1;
+
+    _pl_parallel_sort_t sort = {{size, cmp, arg}, (unsigned char*)base, scratch, num, chunk, flags};
+    if(chunk_count == 1) {
+        sort.chunk = num;
+        _pl_parallel_sort_chunks_internal(&sort, 0, 1);
+        free(scratch);
+        return 0;
+    }
+    pl_jobs_parallel_for(jobs, chunk_count, 1, _pl_parallel_sort_chunks_internal, &sort);
+
+    size_t *run_offsets = (size_t*)malloc(sizeof(size_t) * (chunk_count + 1));
+    int result = 1;
+    if(run_offsets) {
+        for(size_t c = 0; c < chunk_count; c++) run_offsets[c] = c * chunk;
+        run_offsets[chunk_count] = num;
+        result = pl_parallel_merge(jobs, base, scratch, size, run_offsets, chunk_count, cmp, arg);
+        free(run_offsets);
+    }
+    if(result == 0) pl_jobs_parallel_for(jobs, num, chunk, _pl_parallel_sort_copy_internal, &sort);
+    else if(!stable) {
+        pl_qsort_r(base, num, size, cmp, arg);
+        result = 0;
+    }
+
+    free(scratch);
+    return result;
 }
 
 #endif // PLATO_SORT_IMPLEMENTATION
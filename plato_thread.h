@@ -90,7 +90,7 @@
 #if defined(_WIN32)
     typedef struct pl_mtx_s pl_mtx_t;
 #else
-    typedef pthread_mutex_t mtx_t;
+    typedef pthread_mutex_t pl_mtx_t;
 #endif
 
 int pl_mtx_init(pl_mtx_t *mtx, int type);
@@ -703,7 +703,7 @@ int pl_thread_sleep(const struct timespec *duration, struct timespec *remaining)
 #endif
 }
 
-void pl_thrd_yield(void) {
+void pl_thread_yield(void) {
 #if defined(_WIN32)
     Sleep(0);
 #else